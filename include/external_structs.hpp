@@ -1,37 +1,33 @@
+#include <group_reader.hpp>
 
 
 
 
-//it's the remote table struct that holds the config
-struct groupconf{
-    uint32_t inactivate_cust_after_sec;
-    bool is_dac;
+//standard token contract balance table, scoped by holder
+struct token_account{
+    eosio::asset balance;
+    uint64_t primary_key()const { return balance.symbol.code().raw(); }
 };
-typedef eosio::singleton<"groupconf"_n, groupconf> groupconf_table;
+typedef eosio::multi_index<"accounts"_n, token_account> token_accounts_table;
 
+//group config as seen from a module contract, reads the remote coreconf singleton
 class Config{
     private:
-    groupconf groupconfig;
+    groupreader::groupconf groupconfig;
 
     public:
     //constructor
 
     Config(eosio::name contract, eosio::name scope){
-    /*
-        groupconf_table _groupconf(contract, scope.value);
-        groupconfig = _groupconf.get();//singleton
-        */
-        groupconfig = {
-            .inactivate_cust_after_sec = 60*60*30,
-            .is_dac = false
-        };
+        groupreader::coreconf_table _coreconf(contract, scope.value);
+        groupconfig = _coreconf.get_or_default(groupreader::coreconf()).conf;
     }
 
     uint32_t get_inactivate_cust_after_sec(){
         return groupconfig.inactivate_cust_after_sec;
     }
     bool get_is_dac(){
-        return groupconfig.is_dac;
+        return false;//no dac mode in the group config
     }
     //do other more advanced stuff here with the table data
 };
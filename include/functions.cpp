@@ -1,7 +1,7 @@
 group::groupconf group::get_group_conf(){
   //groupconf conf;
   //return conf;
-  coreconf_table _coreconf(get_self(), get_self().value);
+  coreconf_table& _coreconf = coreconf_db();
   auto setting = _coreconf.get_or_create(get_self(), coreconf());
   return setting.conf;
 }
@@ -37,7 +37,7 @@ bool group::member_has_balance(const name& accountname){
 
 void group::update_member_count(int delta){
 
-  corestate_table _corestate(get_self(), get_self().value);
+  corestate_table& _corestate = corestate_db();
   auto state = _corestate.get_or_create(get_self(), corestate());
   state.state.member_count = state.state.member_count + delta;
   _corestate.set(state, get_self());
@@ -45,7 +45,7 @@ void group::update_member_count(int delta){
 
 void group::update_custodian_count(int delta){
 
-  corestate_table _corestate(get_self(), get_self().value);
+  corestate_table& _corestate = corestate_db();
   auto state = _corestate.get_or_create(get_self(), corestate());
   state.state.cust_count = state.state.cust_count + delta;
   _corestate.set(state, get_self());
@@ -58,7 +58,7 @@ bool group::is_account_voice_wrapper(const name& account){
 
 bool group::is_custodian(const name& account, const bool& update_last_active, const bool& check_if_alive) {
 
-  custodians_table _custodians(get_self(), get_self().value);
+  custodians_table& _custodians = custodians_db();
   auto cust_itr = _custodians.find(account.value);
   if(cust_itr == _custodians.end() ){
     return false;
@@ -77,7 +77,7 @@ bool group::is_custodian(const name& account, const bool& update_last_active, co
 }
 
 void group::update_custodian_last_active(const name& account){
-  custodians_table _custodians(get_self(), get_self().value);
+  custodians_table& _custodians = custodians_db();
   auto cust_itr = _custodians.find(account.value);
   check(cust_itr != _custodians.end(), "Internal group error: trying to update non existing custodian.");
   _custodians.modify( cust_itr, same_payer, [&]( auto& a) {
@@ -88,10 +88,11 @@ void group::update_custodian_last_active(const name& account){
 bool group::is_account_alive(time_point_sec last_active){
   
   bool is_alive = (last_active == time_point_sec(0) );
-  if(get_group_conf().inactivate_cust_after_sec != 0){
+  uint32_t inactivate_cust_after_sec = get_group_conf().inactivate_cust_after_sec;
+  if(inactivate_cust_after_sec != 0){
     time_point_sec now = time_point_sec(current_time_point());
     uint32_t inactive_period = now.sec_since_epoch() - last_active.sec_since_epoch();
-    is_alive = (inactive_period >= get_group_conf().inactivate_cust_after_sec);
+    is_alive = (inactive_period >= inactivate_cust_after_sec);
   }
   return !is_alive;
 }
@@ -155,7 +156,7 @@ void group::update_owner_maintainance(const name& maintainer){
 
 void group::update_active() {
 
-  custodians_table _custodians(get_self(), get_self().value);
+  custodians_table& _custodians = custodians_db();
 
   vector<eosiosystem::permission_level_weight> accounts;//active custodians
   vector<eosiosystem::permission_level_weight> inactive_accounts;//inactive custodians
@@ -204,6 +205,8 @@ void group::update_active() {
   }
 
   insert_or_update_or_delete_threshold(name("default"), default_threshold, false, true);
+  //custodian set and default threshold changed
+  refresh_ready_proposals(true, READY_SCAN_BATCH);
 }
 
 void group::sub_balance( const name& account, const extended_asset& value) {
@@ -211,6 +214,18 @@ void group::sub_balance( const name& account, const extended_asset& value) {
    const auto& itr = _balances.get( value.quantity.symbol.raw(), "No balance with this symbol.");
    check( itr.balance >= value, "Overdrawn balance");
 
+  if(account != get_self() ){
+    update_liabilities(account, value, true);
+  }
+
+#if STATE_DIGEST
+  vector<checksum256> added;
+  if(account == get_self() || itr.balance != value){
+    added.push_back(get_balance_leaf(account, itr.balance - value) );
+  }
+  update_digest({get_balance_leaf(account, itr.balance)}, added);
+#endif
+
   if(account != get_self() && itr.balance == value){
     _balances.erase(itr);
     return;
@@ -225,23 +240,86 @@ void group::sub_balance( const name& account, const extended_asset& value) {
 
 
 void group::add_balance( const name& account, const extended_asset& value){
+   if(account != get_self() ){
+     update_liabilities(account, value, false);
+   }
    balances_table _balances( get_self(), account.value);
    auto itr = _balances.find( value.quantity.symbol.raw() );
 
    if( itr == _balances.end() ) {
+#if STATE_DIGEST
+      update_digest({}, {get_balance_leaf(account, value)});
+#endif
       _balances.emplace( get_self(), [&]( auto& a){
         a.balance = value;
       });
    } 
    else {
+#if STATE_DIGEST
+      update_digest({get_balance_leaf(account, itr->balance)}, {get_balance_leaf(account, itr->balance + value)});
+#endif
       _balances.modify( itr, same_payer, [&]( auto& a) {
         a.balance += value;
       });
    }
 }
 
+//members syncliabs hasn't reached yet are skipped, it counts their full balances when it gets there
+void group::update_liabilities(const name& account, const extended_asset& delta, const bool& sub){
+  cursors_table _cursors(get_self(), get_self().value);
+  auto cursor_itr = _cursors.find(name("syncliabs").value);
+  if(cursor_itr == _cursors.end() || account.value >= cursor_itr->next_key){
+    return;
+  }
+  change_liability_total(delta, sub);
+}
+
+void group::change_liability_total(const extended_asset& delta, const bool& sub){
+  liabilities_table _liabilities( get_self(), get_self().value);
+  auto by_token = _liabilities.get_index<"bytoken"_n>();
+  auto itr = by_token.find( (uint128_t{delta.contract.value} << 64) | delta.quantity.symbol.raw() );
+
+  if(sub){
+    check(itr != by_token.end() && itr->total >= delta, "Liability total underflow, run syncliabs.");
+    if(itr->total == delta){
+      by_token.erase(itr);
+      return;
+    }
+    by_token.modify( itr, same_payer, [&]( auto& a) {
+      a.total -= delta;
+    });
+    return;
+  }
+
+  if( itr == by_token.end() ) {
+    _liabilities.emplace( get_self(), [&]( auto& a){
+      a.id = _liabilities.available_primary_key();
+      a.total = delta;
+    });
+  } 
+  else {
+    by_token.modify( itr, same_payer, [&]( auto& a) {
+      a.total += delta;
+    });
+  }
+}
+
+//false when an incoming token must be ignored, asserts when it must be rejected
+bool group::is_token_allowed(const extended_symbol& token, const bool& member_deposit){
+  tokens_table _tokens(get_self(), get_self().value);
+  auto by_token = _tokens.get_index<"bytoken"_n>();
+  if(by_token.find( (uint128_t{token.get_contract().value} << 64) | token.get_symbol().raw() ) != by_token.end() ){
+    return true;
+  }
+  tokenpolicy_table _tokenpolicy(get_self(), get_self().value);
+  name policy = _tokenpolicy.get_or_default(tokenpolicy{name("accept")}).unknown_tokens;
+  check(policy != name("reject"), "Token not accepted by this group.");
+  check(policy == name("accept") || !member_deposit, "Token not accepted for member deposits.");
+  return policy == name("accept");
+}
+
 bool group::is_existing_threshold_name(const name& threshold_name){
-  thresholds_table _thresholds(get_self(), get_self().value);
+  thresholds_table& _thresholds = thresholds_db();
   auto thresh_itr = _thresholds.find(threshold_name.value);
   if(thresh_itr == _thresholds.end() ){
     return false;
@@ -252,7 +330,7 @@ bool group::is_existing_threshold_name(const name& threshold_name){
 }
 
 uint8_t group::get_threshold_by_name(const name& threshold_name){
-  thresholds_table _thresholds(get_self(), get_self().value);
+  thresholds_table& _thresholds = thresholds_db();
   auto thresh_itr = _thresholds.find(threshold_name.value);
   if(thresh_itr == _thresholds.end() ){
     return get_threshold_by_name(name("default"));
@@ -263,7 +341,7 @@ uint8_t group::get_threshold_by_name(const name& threshold_name){
 }
 
 void group::insert_or_update_or_delete_threshold(const name& threshold_name, const int8_t& threshold, const bool& remove, const bool& privileged){
-   thresholds_table _thresholds(get_self(), get_self().value);
+   thresholds_table& _thresholds = thresholds_db();
    auto thresh_itr = _thresholds.find(threshold_name.value);
 
 
@@ -353,6 +431,113 @@ group::threshold_name_and_value group::get_required_threshold_name_and_value_for
   }
 }
 
+//validates and stores a new proposal, or executes it right away when no approvals are needed.
+//with a template_id the row only references the template: actions, title and description stay there and the
+//required threshold is the one resolved when the template was saved
+void group::open_proposal(const name& proposer, const string& title, const string& description, const vector<action>& actions, const time_point_sec& expiration, const bool& auto_exec, const checksum256& trx_id, const uint64_t& template_id){
+  time_point_sec now = time_point_sec(current_time_point());
+
+  //validate actions
+  check(actions.size() > 0 && actions.size() <= MAX_PROPOSAL_ACTIONS, "Number of actions not allowed.");
+
+  bool from_template = template_id != NO_TEMPLATE;
+  proptemplates_table _proptemplates(get_self(), get_self().value);
+  auto tpl_itr = _proptemplates.end();
+  name required_threshold;
+  if(from_template){
+    tpl_itr = _proptemplates.find(template_id);
+    check(tpl_itr != _proptemplates.end(), "Template not found.");
+    required_threshold = tpl_itr->required_threshold;
+  }
+  else{
+    required_threshold = get_max_required_threshold(actions).threshold_name;
+  }
+
+  groupconf conf = get_group_conf();
+  if(get_threshold_by_name(required_threshold) == 0 && conf.exec_on_threshold_zero && actions.size() <= EXEC_CHUNK_SIZE){
+    //immediate execution, no signatures needed
+    for(action act : actions) { 
+        act.send();
+    }
+    return;
+  }
+
+  //validate expiration
+  check( now < expiration, "Expiration must be in the future.");
+  uint32_t seconds_left = expiration.sec_since_epoch() - now.sec_since_epoch();
+  check(seconds_left >= 60*60, "Minimum expiration not met.");
+
+  if(from_template){
+    _proptemplates.modify( tpl_itr, same_payer, [&]( auto& n) {
+        n.open_proposals += 1;
+    });
+  }
+
+  name ram_payer = get_self();
+
+  proposals_table _proposals(get_self(), get_self().value);
+  auto prop_itr = _proposals.emplace(ram_payer, [&](auto& n) {
+    n.id = _proposals.available_primary_key();
+    n.proposer = proposer;
+    n.payload_ids = vector<uint64_t>{};
+    n.description_hash = checksum256();
+    if(!from_template){
+#if DEDUP_PAYLOADS
+      n.payload_ids = store_payloads(actions);
+#else
+      n.actions = actions;
+#endif
+#if HASHED_DESCRIPTIONS
+      n.description = description.substr(0, DESCRIPTION_EXCERPT_SIZE);
+      n.description_hash = sha256(description.data(), description.size() );
+#else
+      n.description = description;
+#endif
+      n.title = title;
+    }
+    n.exec_cursor = 0;
+    n.approval_epoch = 0;
+    n.approvals = {proposer};
+    n.expiration = expiration;
+    n.submitted = now;
+    n.last_actor = proposer;
+    n.trx_id = trx_id;
+    n.required_threshold = required_threshold;
+    n.auto_exec = auto_exec;
+    n.template_id = template_id;
+  });
+  //the proposer's own approval can already meet the threshold
+  if(update_ready_state(prop_itr) && auto_exec){
+    execute_proposal(proposer, _proposals, prop_itr, EXEC_CHUNK_SIZE);
+  }
+
+  if(true){
+  //messagebus(name sender_group, name event, string message)
+    string msg  = "New proposal by "+proposer.to_string();
+    action(
+        permission_level{ get_self(), "owner"_n },
+        name("eosgroups222"),
+        "messagebus"_n,
+        std::make_tuple(get_self(), name("propose"), msg )
+    ).send();
+  }
+}
+
+//find max required threshold, asserts on blocked actions
+group::threshold_name_and_value group::get_max_required_threshold(const vector<action>& actions){
+  threshold_name_and_value max_required_threshold;
+  for (std::vector<int>::size_type i = 0; i != actions.size(); i++){
+    threshold_name_and_value tnav = get_required_threshold_name_and_value_for_contract_action(actions[i].account, actions[i].name);
+    check(tnav.threshold >= 0, "Action is blocked via negative threshold");
+    if(i==0){
+      max_required_threshold = tnav;
+    }
+    else if(tnav.threshold > max_required_threshold.threshold){
+      max_required_threshold = tnav;
+    }
+  }
+  return max_required_threshold;
+}
 
 uint8_t group::get_total_approved_proposal_weight(proposals_table::const_iterator& prop_itr){
   uint8_t total_weight = 0;
@@ -360,7 +545,7 @@ uint8_t group::get_total_approved_proposal_weight(proposals_table::const_iterato
     return total_weight;
   }
   else{
-    custodians_table _custodians(get_self(), get_self().value);
+    custodians_table& _custodians = custodians_db();
     
     for(name approver : prop_itr->approvals){
       auto cust_itr = _custodians.find(approver.value);
@@ -376,6 +561,14 @@ void group::archive_proposal(const name& archive_type, proposals_table& idx, pro
 
   uint8_t keep_history = get_group_conf().proposal_archive_size;
 
+  //template proposals are archived with a copy of the template, it can change once no open proposal references it
+  proptemplates_table _proptemplates(get_self(), get_self().value);
+  auto tpl_itr = _proptemplates.end();
+  if(prop_itr->template_id.value_or(NO_TEMPLATE) != NO_TEMPLATE){
+    tpl_itr = _proptemplates.find(prop_itr->template_id.value() );
+  }
+  bool from_template = tpl_itr != _proptemplates.end();
+
   if(keep_history > 0){
 
     proposals_table h_proposals(get_self(), archive_type.value);
@@ -401,40 +594,565 @@ void group::archive_proposal(const name& archive_type, proposals_table& idx, pro
     h_proposals.emplace(get_self(), [&](auto& n) {
       n.id = h_proposals.available_primary_key();
       n.proposer = prop_itr->proposer;
-      n.actions = prop_itr->actions;
+      n.actions = from_template ? tpl_itr->actions : prop_itr->actions;
       n.approvals = prop_itr->approvals;
       n.expiration = prop_itr->expiration;
       n.submitted = prop_itr->submitted;
-      n.description = prop_itr->description;
-      n.title = prop_itr->title;
+      n.description = from_template ? tpl_itr->description : prop_itr->description;
+      n.title = from_template ? tpl_itr->title : prop_itr->title;
       n.last_actor = prop_itr->last_actor;
       n.required_threshold = prop_itr->required_threshold;
       n.trx_id = prop_itr->trx_id;
+      n.auto_exec = prop_itr->auto_exec;
+      n.template_id = prop_itr->template_id;
+      n.description_hash = prop_itr->description_hash;
+      n.payload_ids = prop_itr->payload_ids;
+      n.exec_cursor = prop_itr->exec_cursor;
+      n.approval_epoch = prop_itr->approval_epoch;
     });
 
   }
+  else{
+    //no archive row takes over the payload references
+    release_payloads(prop_itr->payload_ids.value_or(vector<uint64_t>{}) );
+  }
+  //release the template reference
+  if(from_template){
+    _proptemplates.modify( tpl_itr, same_payer, [&]( auto& n) {
+        n.open_proposals -= 1;
+    });
+  }
+  readyprops_table _readyprops(get_self(), get_self().value);
+  auto ready_itr = _readyprops.find(prop_itr->id);
+  if(ready_itr != _readyprops.end() ){
+    _readyprops.erase(ready_itr);
+  }
   idx.erase(prop_itr);
 
 }
 
+//merges approvers into the approval list in one row update, last approver is recorded as last_actor
+void group::add_approvals(proposals_table& idx, proposals_table::const_iterator& prop_itr, const vector<name>& approvers){
+  check(!is_exec_started(prop_itr), "Proposal is being executed.");
+  std::set<name> new_approvals{};
+  for(name approver : approvers){
+    check(new_approvals.insert(approver).second, "Duplicate approver.");
+  }
+  for (name old_approver: prop_itr->approvals) {
+    //check for dups and clean out non/old custodians.
+    //todo calculate current weight here
+    if(is_custodian(old_approver, false, false)){
+      check(new_approvals.insert(old_approver).second, "You already approved this proposal.");
+    }
+  }
+  idx.modify( prop_itr, same_payer, [&]( auto& n) {
+      n.last_actor = approvers.back();
+      n.approvals = vector<name>(new_approvals.begin(), new_approvals.end() );
+  });
+
+  bool is_ready = update_ready_state(prop_itr);
+
+  //opt-in: the approval that meets the threshold executes and archives the proposal
+  if(is_ready && prop_itr->auto_exec.value_or(false) ){
+    time_point_sec now = time_point_sec(current_time_point());
+    if(now < prop_itr->expiration){
+      execute_proposal(approvers.back(), idx, prop_itr, EXEC_CHUNK_SIZE);
+    }
+  }
+}
+
+//sha256 of (chain id, group, proposal id, proposal trx_id, expiration, approval epoch, sha256 of the packed actions).
+//ids are reused and recurring proposals repeat their actions, trx_id ties a signature to one proposal.
+//unapprove bumps the epoch, a signature collected before it can't be replayed to restore the approval
+checksum256 group::get_approval_digest(proposals_table::const_iterator& prop_itr){
+  coreconf_table& _coreconf = coreconf_db();
+  auto setting = _coreconf.get_or_default(coreconf());
+  check(setting.chain_id.has_value(), "Chain id not set, signed approvals are disabled.");
+  auto packed_actions = pack(get_proposal_actions(prop_itr) );
+  checksum256 actions_hash = sha256(packed_actions.data(), packed_actions.size() );
+  auto packed = pack(std::make_tuple(setting.chain_id.value(), get_self(), prop_itr->id, prop_itr->trx_id, prop_itr->expiration,
+    prop_itr->approval_epoch.value_or(0), actions_hash) );
+  return sha256(packed.data(), packed.size() );
+}
+
+//returns true when the approvals meet the required threshold
+bool group::update_ready_state(proposals_table::const_iterator& prop_itr){
+  bool is_ready = get_total_approved_proposal_weight(prop_itr) >= get_threshold_by_name(prop_itr->required_threshold);
+  readyprops_table _readyprops(get_self(), get_self().value);
+  auto ready_itr = _readyprops.find(prop_itr->id);
+  if(is_ready && ready_itr == _readyprops.end() ){
+    _readyprops.emplace( get_self(), [&]( auto& n){
+      n.id = prop_itr->id;
+      n.expiration = prop_itr->expiration;
+    });
+  }
+  else if(!is_ready && ready_itr != _readyprops.end() ){
+    _readyprops.erase(ready_itr);
+  }
+  return is_ready;
+}
+
+//re-checks the ready state of up to max open proposals, from the readyscan cursor or from the start when restart.
+//a cursors row stays while proposals are left, crank continues from there.
+void group::refresh_ready_proposals(const bool& restart, const uint32_t& max){
+  name job = name("readyscan");
+  uint64_t next_key = 0;
+  if(!restart){
+    cursors_table _cursors(get_self(), get_self().value);
+    auto cursor_itr = _cursors.find(job.value);
+    if(cursor_itr == _cursors.end() ){
+      return;
+    }
+    next_key = cursor_itr->next_key;
+  }
+  proposals_table _proposals(get_self(), get_self().value);
+  auto prop_itr = _proposals.lower_bound(next_key);
+  for(uint32_t counter = 0; prop_itr != _proposals.end() && counter < max; prop_itr++, counter++){
+    update_ready_state(prop_itr);
+    next_key = prop_itr->id + 1;
+  }
+  set_cursor(job, next_key, prop_itr == _proposals.end() );
+}
+
+vector<action> group::get_proposal_actions(proposals_table::const_iterator& prop_itr){
+  if(prop_itr->payload_ids.has_value() && prop_itr->payload_ids.value().size() > 0){
+    payloads_table _payloads(get_self(), get_self().value);
+    vector<action> actions;
+    for(uint64_t payload_id : prop_itr->payload_ids.value() ){
+      actions.push_back(_payloads.get(payload_id, "Payload not found.").act);
+    }
+    return actions;
+  }
+  if(prop_itr->template_id.value_or(NO_TEMPLATE) == NO_TEMPLATE){
+    return prop_itr->actions;
+  }
+  proptemplates_table _proptemplates(get_self(), get_self().value);
+  return _proptemplates.get(prop_itr->template_id.value(), "Template not found.").actions;
+}
+
+//returns the payload id per action, identical actions share one row
+vector<uint64_t> group::store_payloads(const vector<action>& actions){
+  payloads_table _payloads(get_self(), get_self().value);
+  auto by_hash = _payloads.get_index<"byhash"_n>();
+  vector<uint64_t> payload_ids;
+  for(const action& act : actions){
+    auto packed = pack(act);
+    checksum256 hash = sha256(packed.data(), packed.size() );
+    auto payload_itr = by_hash.find(hash);
+    if(payload_itr != by_hash.end() ){
+      by_hash.modify( payload_itr, same_payer, [&]( auto& n) {
+          n.refs += 1;
+      });
+      payload_ids.push_back(payload_itr->id);
+    }
+    else{
+      uint64_t id = _payloads.available_primary_key();
+      _payloads.emplace( get_self(), [&]( auto& n){
+          n.id = id;
+          n.hash = hash;
+          n.act = act;
+          n.refs = 1;
+      });
+      payload_ids.push_back(id);
+    }
+  }
+  return payload_ids;
+}
+
+void group::release_payloads(const vector<uint64_t>& payload_ids){
+  if(payload_ids.size() == 0){
+    return;
+  }
+  payloads_table _payloads(get_self(), get_self().value);
+  for(uint64_t payload_id : payload_ids){
+    auto payload_itr = _payloads.find(payload_id);
+    if(payload_itr == _payloads.end() ){
+      continue;
+    }
+    if(payload_itr->refs <= 1){
+      _payloads.erase(payload_itr);
+    }
+    else{
+      _payloads.modify( payload_itr, same_payer, [&]( auto& n) {
+          n.refs -= 1;
+      });
+    }
+  }
+}
+
+//sends up to max actions from the cursor on, archives after the last one. returns true when finished
+bool group::execute_proposal(const name& executer, proposals_table& idx, proposals_table::const_iterator& prop_itr, const uint32_t& max){
+  vector<action> actions = get_proposal_actions(prop_itr);
+  uint32_t cursor = prop_itr->exec_cursor.value_or(0);
+  uint32_t end = std::min<uint32_t>(cursor + max, actions.size() );
+  for(uint32_t i = cursor; i < end; i++) { 
+      actions[i].send();
+  }
+
+  bool finished = end == actions.size();
+  idx.modify( prop_itr, same_payer, [&]( auto& n) {
+      n.last_actor = executer;
+      n.fill_extensions();
+      n.exec_cursor = finished ? 0 : end;
+  });
+
+  if(finished){
+    archive_proposal(name("executed"), idx, prop_itr);
+  }
+  return finished;
+}
+
+bool group::is_exec_started(proposals_table::const_iterator& prop_itr){
+  return is_exec_started_row(*prop_itr);
+}
+
+bool group::is_exec_started_row(const proposals& prop){
+  return prop.exec_cursor.value_or(0) > 0;
+}
+
+//started and past the EXEC_GRACE_SEC window, e.g. a later chunk keeps failing
+bool group::is_exec_abandoned(const proposals& prop){
+  return is_exec_started_row(prop) && current_time_point().sec_since_epoch() >= prop.expiration.sec_since_epoch() + EXEC_GRACE_SEC;
+}
+
 bool group::has_module(const name& module_name){
+  return get_module_account(module_name) != name(0);
+}
 
+name group::get_module_account(const name& module_name){
+  for(module_binding mb : get_module_registry() ){
+    if(mb.module_name == module_name){
+      return mb.account;
+    }
+  }
+  return name(0);
+}
+
+vector<group::module_binding> group::get_module_registry(){
+  coreconf_table& _coreconf = coreconf_db();
+  auto setting = _coreconf.get_or_default(coreconf());
+  if(setting.modules.has_value() ){
+    return setting.modules.value();
+  }
+  //registry not initialized yet -> build it from the childaccount table once and store it
+  vector<module_binding> registry;
   childaccounts_table _childaccounts(get_self(), get_self().value);
-  auto by_module_name = _childaccounts.get_index<"bymodulename"_n>();
-  auto itr = by_module_name.find(module_name.value); //use get here
-  if(itr == by_module_name.end()){
+  for(auto itr = _childaccounts.begin(); itr != _childaccounts.end(); itr++){
+    if(itr->module_name != name(0) ){
+      registry.push_back(module_binding{itr->module_name, itr->account_name});
+    }
+  }
+  setting.modules = registry;
+  _coreconf.set(setting, get_self());
+  return registry;
+}
+
+void group::set_module_binding(const name& module_name, const name& account, const bool& remove){
+  vector<module_binding> registry = get_module_registry();
+  auto mb_itr = std::find_if(registry.begin(), registry.end(), [&](const module_binding& mb){ return mb.module_name == module_name; });
+  if(remove){
+    check(mb_itr != registry.end(), "Module name not registered.");
+    registry.erase(mb_itr);
+  }
+  else{
+    check(mb_itr == registry.end(), "Duplicate module name.");
+    check(registry.size() < MAX_MODULES, "Maximum number of modules reached.");
+    registry.push_back(module_binding{module_name, account});
+  }
+  coreconf_table& _coreconf = coreconf_db();
+  auto setting = _coreconf.get_or_default(coreconf());
+  setting.modules = registry;
+  _coreconf.set(setting, get_self());
+}
+
+void group::spawn_child_accounts(const vector<childac_spec>& specs){
+  //validate and sum up, one balance debit for the whole batch
+  asset total_value = specs[0].ram_amount;
+  total_value.amount = 0;
+  for(childac_spec spec : specs){
+    check(!is_account(spec.new_account), "The chosen accountname is already taken.");
+    total_value += spec.ram_amount + spec.net_amount + spec.cpu_amount;
+  }
+  extended_asset extended_total_value = extended_asset(total_value, name("eosio.token") );
+  sub_balance( get_self(), extended_total_value);
+
+  corestate_table& _corestate = corestate_db();
+  auto state = _corestate.get_or_create(get_self(), corestate());
+  extended_asset prepaid = state.prepaid_resources.value_or(extended_asset(asset(0, total_value.symbol), name("eosio.token") ) );
+  state.prepaid_resources = prepaid + extended_total_value;
+  _corestate.set(state, get_self());
+
+  bool transfer_bw = false;
+
+  for(childac_spec spec : specs){
+    name parent = spec.parent == name(0) ? get_self() : spec.parent;
+
+    vector<eosiosystem::permission_level_weight> controller_accounts;
+    eosiosystem::permission_level_weight pmlw_parent_active{
+        .permission = permission_level{parent, "active"_n},
+        .weight = (uint16_t) 1,
+    };
+    controller_accounts.push_back(pmlw_parent_active);
+
+    eosiosystem::authority authority{
+        .threshold = 1,
+        .accounts = controller_accounts,
+        .waits = {},
+        .keys = {}
+    };
+
+    //create new account
+    action(
+        permission_level{ get_self(), "owner"_n },
+        "eosio"_n,
+        "newaccount"_n,
+        std::make_tuple(get_self(), spec.new_account, authority, authority )
+    ).send();
+
+    //buy resources, the system contract takes a single receiver per call
+    if(spec.net_amount.amount > 0 || spec.cpu_amount.amount > 0){
+      action(
+          permission_level{ get_self(), "owner"_n },
+          "eosio"_n,
+          "delegatebw"_n,
+          std::make_tuple(get_self(), spec.new_account, spec.net_amount, spec.cpu_amount, transfer_bw )
+      ).send();
+    }
+    if(spec.ram_amount.amount > 0){
+      action(
+          permission_level{ get_self(), "owner"_n },
+          "eosio"_n,
+          "buyram"_n,
+          std::make_tuple(get_self(), spec.new_account, spec.ram_amount )
+      ).send();
+    }
+
+    //account doesn't exist until the inline newaccount runs, so write the row directly
+    insert_child_account(spec.new_account, parent, spec.module_name);
+  }
+
+  //inline actions run depth first, this one runs after every transfer of the actions above
+  action(
+      permission_level{ get_self(), "owner"_n },
+      get_self(),
+      "endspawn"_n,
+      std::make_tuple()
+  ).send();
+}
+
+void group::remove_child_account(childaccounts_table& idx, childaccounts_table::const_iterator& itr){
+  if(itr->module_name != name(0) ){
+    set_module_binding(itr->module_name, itr->account_name, true);
+  }
+  idx.erase(itr);
+}
+
+void group::insert_child_account(const name& account, name parent, const name& module_name){
+  //check if account already a child
+  childaccounts_table _childaccounts(get_self(), get_self().value);
+  auto itr = _childaccounts.find(account.value);
+  check(itr == _childaccounts.end(), "Account is already registered as child.");
+
+  //check if parent is valid
+  parent = parent == name(0) ? get_self() : parent;
+  if(parent != get_self() ){
+    itr = _childaccounts.find(parent.value);
+    check(itr != _childaccounts.end(), "Parent account is not a child.");
+  }
+
+  //register module name, asserts on duplicates
+  if(module_name != name(0) ){
+    set_module_binding(module_name, account, false);
+  }
+
+  _childaccounts.emplace( get_self(), [&]( auto& n){
+      n.account_name = account;
+      n.parent = parent;
+      n.module_name = module_name;
+  });
+}
+
+bool group::consume_prepaid_resources(const name& to, const extended_asset& value){
+  if(to != name("eosio.ram") && to != name("eosio.ramfee") && to != name("eosio.stake") ){
+    return false;
+  }
+  corestate_table& _corestate = corestate_db();
+  auto state = _corestate.get_or_default(corestate());
+  if(!state.prepaid_resources.has_value() ){
     return false;
   }
+  extended_asset prepaid = state.prepaid_resources.value();
+  if(prepaid.contract != value.contract || prepaid.quantity.symbol != value.quantity.symbol || prepaid.quantity.amount < value.quantity.amount){
+    return false;
+  }
+  prepaid.quantity.amount -= value.quantity.amount;
+  state.prepaid_resources = prepaid;
+  _corestate.set(state, get_self());
+  return true;
+}
+
+//the balance must already be debited, the outgoing notification only clears the marker
+void group::send_withdrawal(const name& to, const extended_asset& value){
+  pendingxfrs_table _pendingxfrs(get_self(), to.value);
+  auto itr = _pendingxfrs.find(value.quantity.symbol.raw() );
+  if(itr == _pendingxfrs.end() ){
+    _pendingxfrs.emplace( get_self(), [&]( auto& n){
+        n.amount = value;
+    });
+  }
   else{
-    return true;
+    check(itr->amount.contract == value.contract, "Pending withdrawal for another token contract.");
+    _pendingxfrs.modify( itr, same_payer, [&]( auto& n) {
+        n.amount += value;
+    });
   }
+  action(
+    permission_level{get_self(), "owner"_n},
+    value.contract, "transfer"_n,
+    make_tuple(get_self(), to, value.quantity, string("withdraw from user account"))
+  ).send();
 }
 
+bool group::consume_pending_withdrawal(const name& to, const extended_asset& value){
+  pendingxfrs_table _pendingxfrs(get_self(), to.value);
+  auto itr = _pendingxfrs.find(value.quantity.symbol.raw() );
+  if(itr == _pendingxfrs.end() || itr->amount.contract != value.contract || itr->amount.quantity.amount < value.quantity.amount){
+    return false;
+  }
+  if(itr->amount == value){
+    _pendingxfrs.erase(itr);
+  }
+  else{
+    _pendingxfrs.modify( itr, same_payer, [&]( auto& n) {
+        n.amount -= value;
+    });
+  }
+  return true;
+}
 
+uint64_t group::get_cursor(const name& job){
+  cursors_table _cursors(get_self(), get_self().value);
+  auto itr = _cursors.find(job.value);
+  return itr == _cursors.end() ? 0 : itr->next_key;
+}
 
+void group::set_cursor(const name& job, const uint64_t& next_key, const bool& done){
+  cursors_table _cursors(get_self(), get_self().value);
+  auto itr = _cursors.find(job.value);
+  if(done){
+    if(itr != _cursors.end() ){
+      _cursors.erase(itr);
+    }
+    return;
+  }
+  if(itr == _cursors.end() ){
+    _cursors.emplace( get_self(), [&]( auto& n){
+      n.job = job;
+      n.next_key = next_key;
+    });
+  }
+  else{
+    _cursors.modify( itr, same_payer, [&]( auto& n){
+      n.next_key = next_key;
+    });
+  }
+}
 
+//multi_index stores index N of a table in the db table (table_name & ~0xF) | N.
+//write the expected key into every active slot and drop entries left in slots that are no longer declared.
+void group::rebuild_idx64_row(const name& table, const uint64_t& scope, const uint64_t& primary, const vector<uint64_t>& keys, const uint8_t& max_slots){
+  using namespace eosio::internal_use_do_not_use;
+  for(uint8_t slot = 0; slot < max_slots; slot++){
+    uint64_t idx_table = (table.value & 0xFFFFFFFFFFFFFFF0ULL) | slot;
+    uint64_t old_key = 0;
+    int32_t idx_itr = db_idx64_find_primary(get_self().value, scope, idx_table, &old_key, primary);
+    if(slot < keys.size() ){
+      uint64_t key = keys[slot];
+      if(idx_itr < 0){
+        db_idx64_store(scope, idx_table, get_self().value, primary, &key);
+      }
+      else if(old_key != key){
+        db_idx64_update(idx_itr, get_self().value, &key);
+      }
+    }
+    else if(idx_itr >= 0){
+      db_idx64_remove(idx_itr);
+    }
+  }
+}
 
+//same for a single idx256 index at slot, -1 when the index isn't declared
+void group::rebuild_idx256_row(const name& table, const uint64_t& scope, const uint64_t& primary, const int8_t& slot, const checksum256& key, const uint8_t& max_slots){
+  using namespace eosio::internal_use_do_not_use;
+  auto words = key.get_array();
+  for(uint8_t s = 0; s < max_slots; s++){
+    uint64_t idx_table = (table.value & 0xFFFFFFFFFFFFFFF0ULL) | s;
+    uint128_t old_key[2] = {0, 0};
+    int32_t idx_itr = db_idx256_find_primary(get_self().value, scope, idx_table, old_key, 2, primary);
+    if(s == slot){
+      if(idx_itr < 0){
+        db_idx256_store(scope, idx_table, get_self().value, primary, words.data(), 2);
+      }
+      else if(old_key[0] != words[0] || old_key[1] != words[1]){
+        db_idx256_update(idx_itr, get_self().value, words.data(), 2);
+      }
+    }
+    else if(idx_itr >= 0){
+      db_idx256_remove(idx_itr);
+    }
+  }
+}
 
+checksum256 group::get_member_leaf(const name& account){
+  auto packed = pack(std::make_tuple(name("member"), account) );
+  return sha256(packed.data(), packed.size() );
+}
 
+checksum256 group::get_balance_leaf(const name& account, const extended_asset& balance){
+  auto packed = pack(std::make_tuple(name("balance"), account, balance) );
+  return sha256(packed.data(), packed.size() );
+}
 
+//leaf expanded to 4096 bits: limbs 4i..4i+3 are sha256(uint8 i, leaf) read as little endian uint64s
+void group::expand_leaf(const checksum256& leaf, vector<uint64_t>& expanded){
+  expanded.assign(DIGEST_LIMBS, 0);
+  for(uint8_t i = 0; i < DIGEST_LIMBS / 4; i++){
+    auto packed = pack(std::make_tuple(i, leaf) );
+    auto bytes = sha256(packed.data(), packed.size() ).extract_as_byte_array();
+    for(uint8_t b = 0; b < 32; b++){
+      expanded[i * 4 + b / 8] |= uint64_t(bytes[b]) << (8 * (b % 8) );
+    }
+  }
+}
 
+//digest -= removed leaves, += added leaves. one singleton read and write per call, so a balance change
+//(old leaf out, new leaf in) or a member batch costs a single write
+void group::update_digest(const vector<checksum256>& removed, const vector<checksum256>& added){
+  statedigest_table _statedigest(get_self(), get_self().value);
+  auto sd = _statedigest.get_or_default(statedigest());
+  sd.acc.resize(DIGEST_LIMBS, 0);
+
+  vector<uint64_t> expanded;
+  for(const checksum256& leaf : removed){
+    expand_leaf(leaf, expanded);
+    uint64_t borrow = 0;
+    for(uint8_t i = 0; i < DIGEST_LIMBS; i++){
+      uint64_t limb = sd.acc[i];
+      uint64_t sub = expanded[i] + borrow;
+      borrow = (sub < borrow || limb < sub) ? 1 : 0;
+      sd.acc[i] = limb - sub;
+    }
+  }
+  for(const checksum256& leaf : added){
+    expand_leaf(leaf, expanded);
+    uint64_t carry = 0;
+    for(uint8_t i = 0; i < DIGEST_LIMBS; i++){
+      uint64_t limb = sd.acc[i];
+      uint64_t sum = limb + expanded[i];
+      uint64_t next_carry = sum < limb ? 1 : 0;
+      sd.acc[i] = sum + carry;
+      carry = next_carry | (sd.acc[i] < sum ? 1 : 0);
+    }
+  }
+  _statedigest.set(sd, get_self());
+}
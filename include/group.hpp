@@ -3,14 +3,90 @@
 #include <eosio/asset.hpp>
 //#include <eosio/system.hpp>
 #include <eosio/permission.hpp>
+#include <eosio/crypto.hpp>
 #include <eosio/singleton.hpp>
 #include <system_structs.hpp>
 #include <external_structs.hpp>
 #include <math.h>
+#include <optional>
 
 using namespace std;
 using namespace eosio;
 
+//optional secondary indices, the contract itself only reads bytrxid (findbytrx).
+//build with -D<FLAG>=0 to stop maintaining one. changing a flag moves index slots, so the rebuildidx calls for the
+//affected tables have to run in the same transaction as the setcode, see "Changing index flags" in the README.
+#ifndef PROPOSALS_BYTHRESHOLD
+#define PROPOSALS_BYTHRESHOLD 1
+#endif
+#ifndef PROPOSALS_BYPROPOSER
+#define PROPOSALS_BYPROPOSER 1
+#endif
+#ifndef PROPOSALS_BYTRXID
+#define PROPOSALS_BYTRXID 1
+#endif
+#ifndef CUSTODIANS_BYLASTACTIVE
+#define CUSTODIANS_BYLASTACTIVE 1
+#endif
+
+//store only sha256 + an excerpt of proposal descriptions, the full text stays in the propose transaction (trx_id)
+#ifndef HASHED_DESCRIPTIONS
+#define HASHED_DESCRIPTIONS 0
+#endif
+#ifndef DESCRIPTION_EXCERPT_SIZE
+#define DESCRIPTION_EXCERPT_SIZE 64
+#endif
+
+//proposals may hold up to MAX_PROPOSAL_ACTIONS, exec/execnext send at most EXEC_CHUNK_SIZE per transaction
+#ifndef MAX_PROPOSAL_ACTIONS
+#define MAX_PROPOSAL_ACTIONS 256
+#endif
+#ifndef EXEC_CHUNK_SIZE
+#define EXEC_CHUNK_SIZE 7
+#endif
+
+//a started chunked execution may continue this long past the expiration, after that it can only be archived as expired
+#ifndef EXEC_GRACE_SEC
+#define EXEC_GRACE_SEC 60*60*24
+#endif
+
+//max packed size of a staged proposal (propstart/propappend), propseal moves it onto group paid RAM.
+//the chain's default max_inline_action_size, large enough for a setcode of a full contract
+#ifndef MAX_DRAFT_BYTES
+#define MAX_DRAFT_BYTES 524288
+#endif
+
+//max size of a single propappend chunk, keeps each append within one transaction's cpu budget
+#ifndef MAX_DRAFT_CHUNK_BYTES
+#define MAX_DRAFT_CHUNK_BYTES 32768
+#endif
+
+//upper bound for crank(max_proposals), each proposal sends at most EXEC_CHUNK_SIZE inline actions
+#ifndef CRANK_MAX_PROPOSALS
+#define CRANK_MAX_PROPOSALS 20
+#endif
+
+//proposals re-checked right away when the custodian set or a threshold changes, crank continues the rescan
+#ifndef READY_SCAN_BATCH
+#define READY_SCAN_BATCH 20
+#endif
+
+//store proposal actions once per distinct payload in the payloads table, reference counted by live and archived proposals
+#ifndef DEDUP_PAYLOADS
+#define DEDUP_PAYLOADS 0
+#endif
+
+//max accounts per regmembers/unregmembers call, longer lists are rejected
+#ifndef MEMBER_BATCH_SIZE
+#define MEMBER_BATCH_SIZE 200
+#endif
+
+//maintain the members/balances state digest, build with -DSTATE_DIGEST=1 to enable it. costs one singleton write per
+//balance change. only deploy it on a new group: rows written before it was enabled are not in the digest
+#ifndef STATE_DIGEST
+#define STATE_DIGEST 0
+#endif
+
 CONTRACT group : public contract {
   public:
     using contract::contract;
@@ -46,6 +122,25 @@ CONTRACT group : public contract {
         }
     */
 
+    struct module_binding{
+      name module_name;
+      name account;
+    };
+
+    struct signed_approval{
+      name approver;
+      signature sig;
+    };
+
+    struct childac_spec{
+      name new_account;
+      asset ram_amount;
+      asset net_amount;
+      asset cpu_amount;
+      name parent;
+      name module_name;
+    };
+
     struct groupconf{
       uint8_t max_custodians = 0;
       uint32_t inactivate_cust_after_sec = 60*60*24*30;
@@ -63,26 +158,53 @@ CONTRACT group : public contract {
     ACTION removecust(name account);
     ACTION isetcusts(vector<name> accounts);//"elections" module interface action
 
-    ACTION propose(name proposer, string title, string description, vector<action> actions, time_point_sec expiration);
+    ACTION propose(name proposer, string title, string description, vector<action> actions, time_point_sec expiration, binary_extension<bool> auto_exec);
+    ACTION propstart(name proposer, string title, string description);
+    ACTION propappend(name proposer, uint64_t draft_id, vector<char> chunk);
+    ACTION propseal(name proposer, uint64_t draft_id, time_point_sec expiration, bool auto_exec);
+    ACTION propdiscard(name proposer, uint64_t draft_id);
+    ACTION proposetpl(name proposer, uint64_t template_id, time_point_sec expiration);
+    ACTION mantemplate(uint64_t template_id, string title, string description, vector<action> actions, bool remove);
     ACTION approve(name approver, uint64_t id);
+    ACTION approvesigned(uint64_t id, vector<signed_approval> approvals);
+    ACTION setapprkey(name account, public_key key);
+    ACTION setchainid(checksum256 chain_id);
     ACTION unapprove(name unapprover, uint64_t id);
     ACTION cancel(name canceler, uint64_t id);
     ACTION exec(name executer, uint64_t id);
+    ACTION execnext(name executer, uint64_t id, uint32_t max);
+    ACTION crank(uint32_t max_proposals);
     ACTION trunchistory(name archive_type, uint32_t batch_size);
+    ACTION compactmems(uint32_t batch_size);
+    ACTION rebuildidx(name table, name scope, uint32_t batch_size);
+    ACTION findbytrx(checksum256 trx_id);
 
     ACTION widthdraw(name account, extended_asset amount);
+    ACTION withdrawall(name account, vector<extended_symbol> filter);
+    ACTION solvency(extended_symbol token);
+    ACTION syncliabs(uint32_t batch_size);
+    ACTION getdigest();
     ACTION internalxfr(name from, name to, extended_asset amount, string msg);
     ACTION imalive(name account);
     ACTION spawnchildac(name new_account, asset ram_amount, asset net_amount, asset cpu_amount, name parent, name module_name);
+    ACTION spawnchilds(vector<childac_spec> specs);
+    ACTION endspawn();
     ACTION addchildac(name account, name parent, name module_name);
     ACTION remchildac(name account);
+    ACTION remsubtree(name root, uint32_t max);
+    ACTION getsubtree(name root);
 
     ACTION manthreshold(name threshold_name, int8_t threshold, bool remove);
     //ACTION manactlinks(name contract, vector<action_threshold> new_action_thresholds);//will be deprecated
     ACTION manthreshlin(name contract, name action_name, name threshold_name, bool remove);
 
+    ACTION mantoken(extended_symbol token, bool remove);
+    ACTION settokenpol(name unknown_tokens);
+
     ACTION regmember(name actor);
     ACTION unregmember(name actor);
+    ACTION regmembers(vector<name> accounts, name payer);
+    ACTION unregmembers(vector<name> accounts);
 
     ACTION updateconf(groupconf new_conf, bool remove);
 
@@ -92,6 +214,11 @@ CONTRACT group : public contract {
 
 
   private:
+
+    static constexpr uint8_t MAX_MODULES = 10;//size cap of the module registry in coreconf
+    static constexpr uint64_t NO_TEMPLATE = UINT64_MAX;
+    static constexpr uint64_t CURSOR_DONE = UINT64_MAX;//next_key of a finished job that keeps its cursors row
+    static constexpr uint8_t DIGEST_LIMBS = 64;//4096 bit state digest
   
     struct threshold_name_and_value{
       name threshold_name;
@@ -101,14 +228,26 @@ CONTRACT group : public contract {
 
     TABLE coreconf{
       groupconf conf;
+      binary_extension< vector<module_binding> > modules;//module_name -> account, mirrors childaccount rows with a module_name
+      binary_extension<checksum256> chain_id;//signed approvals are bound to it, contracts can't read the chain id
     };
     typedef eosio::singleton<"coreconf"_n, coreconf> coreconf_table;
 
     TABLE corestate{
       groupstate state;
+      binary_extension<extended_asset> prepaid_resources;//already debited, consumed by the system contract transfer notifications
     };
     typedef eosio::singleton<"corestate"_n, corestate> corestate_table;
 
+    //additive multiset hash over all member and balance leaves, order independent so updates are O(1).
+    //sum of the expanded leaves mod 2^4096, little endian limbs. the wide modulus keeps generalized birthday
+    //collisions around 2^128 work. it has no inclusion proofs: verifiers recompute it from a full members/balances export.
+    //there is no backfill, it only matches the tables on groups built with STATE_DIGEST from their first row.
+    TABLE statedigest{
+      vector<uint64_t> acc;
+    };
+    typedef eosio::singleton<"statedigest"_n, statedigest> statedigest_table;
+
     TABLE threshlinks {
       uint64_t id;
       name contract;
@@ -145,37 +284,117 @@ CONTRACT group : public contract {
       name required_threshold;
       name last_actor;
       checksum256 trx_id;
+      //binary extensions, always write all of them so later ones deserialize in place
+      binary_extension<bool> auto_exec;//execute from within the approve that meets the threshold
+      binary_extension<uint64_t> template_id;//open proposals read actions from proptemplates, archive rows carry a copy. NO_TEMPLATE otherwise
+      binary_extension<checksum256> description_hash;//sha256 of the full description when built with HASHED_DESCRIPTIONS
+      binary_extension< vector<uint64_t> > payload_ids;//actions stored in payloads when built with DEDUP_PAYLOADS
+      binary_extension<uint32_t> exec_cursor;//index of the next action to execute, > 0 while a chunked execution is in progress
+      binary_extension<uint32_t> approval_epoch;//bumped by unapprove, part of the approval digest so older signatures stop verifying
+
+      //rows written before the extensions existed: give earlier extensions a value before a later one is set
+      void fill_extensions(){
+        if(!auto_exec.has_value() ) auto_exec = false;
+        if(!template_id.has_value() ) template_id = NO_TEMPLATE;
+        if(!description_hash.has_value() ) description_hash = checksum256();
+        if(!payload_ids.has_value() ) payload_ids = vector<uint64_t>{};
+        if(!exec_cursor.has_value() ) exec_cursor = 0;
+        if(!approval_epoch.has_value() ) approval_epoch = 0;
+      }
 
       auto primary_key() const { return id; }
       uint64_t by_threshold() const { return required_threshold.value; }
       uint64_t by_proposer() const { return proposer.value; }
       uint64_t by_expiration() const { return expiration.sec_since_epoch(); }
+      checksum256 by_trx_id() const { return trx_id; }
     };
     typedef multi_index<name("proposals"), proposals,
+#if PROPOSALS_BYTHRESHOLD
       eosio::indexed_by<"bythreshold"_n, eosio::const_mem_fun<proposals, uint64_t, &proposals::by_threshold>>,
+#endif
+#if PROPOSALS_BYPROPOSER
       eosio::indexed_by<"byproposer"_n, eosio::const_mem_fun<proposals, uint64_t, &proposals::by_proposer>>,
+#endif
       eosio::indexed_by<"byexpiration"_n, eosio::const_mem_fun<proposals, uint64_t, &proposals::by_expiration>>
+#if PROPOSALS_BYTRXID
+      ,eosio::indexed_by<"bytrxid"_n, eosio::const_mem_fun<proposals, checksum256, &proposals::by_trx_id>>
+#endif
     > proposals_table;
 
+    //staged proposals, packed_actions is a packed vector<action> uploaded in chunks. paid by the proposer until sealed
+    TABLE drafts {
+      uint64_t id;
+      name proposer;
+      string title;
+      string description;
+      vector<char> packed_actions;
+      checksum256 trx_id;//of propstart, carried over to the proposal
+
+      auto primary_key() const { return id; }
+    };
+    typedef multi_index<name("drafts"), drafts> drafts_table;
+
+    //content addressed action payloads shared by proposals
+    TABLE payloads {
+      uint64_t id;
+      checksum256 hash;//sha256 of the packed action
+      action act;
+      uint32_t refs = 0;
+
+      auto primary_key() const { return id; }
+      checksum256 by_hash() const { return hash; }
+    };
+    typedef multi_index<name("payloads"), payloads,
+      eosio::indexed_by<"byhash"_n, eosio::const_mem_fun<payloads, checksum256, &payloads::by_hash>>
+    > payloads_table;
+
+    //recurring proposal payloads, proposals created from a template reference it instead of copying the actions
+    TABLE proptemplates {
+      uint64_t id;
+      string title;
+      string description;
+      vector<action> actions;
+      name required_threshold;//resolved when the template is saved
+      uint32_t open_proposals = 0;//template can't change while referenced
+
+      auto primary_key() const { return id; }
+    };
+    typedef multi_index<name("proptemplate"), proptemplates> proptemplates_table;
+
+    //open proposals whose approvals meet the required threshold, clients filter out expired ones via byexpiration
+    TABLE readyprops {
+      uint64_t id;
+      time_point_sec expiration;
+
+      auto primary_key() const { return id; }
+      uint64_t by_expiration() const { return expiration.sec_since_epoch(); }
+    };
+    typedef multi_index<name("readyprops"), readyprops,
+      eosio::indexed_by<"byexpiration"_n, eosio::const_mem_fun<readyprops, uint64_t, &readyprops::by_expiration>>
+    > readyprops_table;
+
     TABLE custodians {
       name account;
       name authority = name("active");
       uint8_t weight = 1;
       time_point_sec joined = time_point_sec(current_time_point().sec_since_epoch());
       time_point_sec last_active;
+      binary_extension<public_key> approval_key;//key for off-chain signed approvals
 
       auto primary_key() const { return account.value; }
       uint64_t by_last_active() const { return last_active.sec_since_epoch(); }
     };
-    typedef multi_index<name("custodians"), custodians,
-      eosio::indexed_by<"bylastactive"_n, eosio::const_mem_fun<custodians, uint64_t, &custodians::by_last_active>>
+    typedef multi_index<name("custodians"), custodians
+#if CUSTODIANS_BYLASTACTIVE
+      ,eosio::indexed_by<"bylastactive"_n, eosio::const_mem_fun<custodians, uint64_t, &custodians::by_last_active>>
+#endif
     > custodians_table;
 
+    //compact layout, optional fields are only stored when set.
+    //legacy rows also carry r1 and r2 after agreement_date, they are ignored on read and dropped by compactmems
     TABLE members {
       name account;
-      time_point_sec agreement_date;
-      uint64_t r1;
-      uint64_t r2;
+      binary_extension<time_point_sec> agreement_date;
       auto primary_key() const { return account.value; }
 
     };
@@ -188,17 +407,88 @@ CONTRACT group : public contract {
     };
     typedef multi_index<"balances"_n, balances> balances_table;
 
+    //scoped by recipient, marks withdrawals that are already debited. created and erased within the withdraw transaction
+    TABLE pendingxfrs {
+      extended_asset amount;
+      uint64_t primary_key()const { return amount.quantity.symbol.raw(); }
+    };
+    typedef multi_index<"pendingxfrs"_n, pendingxfrs> pendingxfrs_table;
+
+    //accepted incoming tokens, one row per (contract, symbol)
+    TABLE tokens {
+      uint64_t id;
+      extended_symbol token;
+      auto primary_key() const { return id; }
+      uint128_t by_token() const { return (uint128_t{token.get_contract().value} << 64) | token.get_symbol().raw(); }
+    };
+    typedef multi_index<"tokens"_n, tokens,
+      eosio::indexed_by<"bytoken"_n, eosio::const_mem_fun<tokens, uint128_t, &tokens::by_token>>
+    > tokens_table;
+
+    //what happens to incoming tokens that aren't in the tokens table: accept (default), ignore or reject.
+    //member deposits of unlisted tokens are rejected under ignore too, the member would never be credited
+    //the group can still send ignored tokens out, transfers of a token without a balances row are not debited
+    TABLE tokenpolicy{
+      name unknown_tokens;
+    };
+    typedef eosio::singleton<"tokenpolicy"_n, tokenpolicy> tokenpolicy_table;
+
+    //sum of all member balances per (contract, symbol), maintained by add_balance/sub_balance once syncliabs has counted
+    //the member. the syncliabs cursor tells which members are counted: absent -> none, CURSOR_DONE -> all
+    TABLE liabilities {
+      uint64_t id;
+      extended_asset total;
+      auto primary_key() const { return id; }
+      uint128_t by_token() const { return (uint128_t{total.contract.value} << 64) | total.quantity.symbol.raw(); }
+    };
+    typedef multi_index<"liabilities"_n, liabilities,
+      eosio::indexed_by<"bytoken"_n, eosio::const_mem_fun<liabilities, uint128_t, &liabilities::by_token>>
+    > liabilities_table;
+
     TABLE childaccounts {
       name account_name;
       name parent;
       name module_name;
       auto primary_key() const { return account_name.value; }
       uint64_t by_module_name() const { return module_name.value; }
+      uint64_t by_parent() const { return parent.value; }
     };
     typedef multi_index<name("childaccount"), childaccounts,
-      eosio::indexed_by<"bymodulename"_n, eosio::const_mem_fun<childaccounts, uint64_t, &childaccounts::by_module_name>>
+      eosio::indexed_by<"bymodulename"_n, eosio::const_mem_fun<childaccounts, uint64_t, &childaccounts::by_module_name>>,
+      eosio::indexed_by<"byparent"_n, eosio::const_mem_fun<childaccounts, uint64_t, &childaccounts::by_parent>>
     > childaccounts_table;
 
+    //resume position of batched maintenance jobs
+    TABLE cursors {
+      name job;
+      uint64_t next_key;
+      auto primary_key() const { return job.value; }
+    };
+    typedef multi_index<name("cursors"), cursors> cursors_table;
+
+    //one table handle per action for the group tables read by many helpers, repeated finds hit the multi_index row cache.
+    //don't construct these tables anywhere else, a second instance would keep serving rows that were modified through this one.
+    std::optional<custodians_table> _custodians_db;
+    std::optional<thresholds_table> _thresholds_db;
+    std::optional<coreconf_table> _coreconf_db;
+    std::optional<corestate_table> _corestate_db;
+    custodians_table& custodians_db(){
+      if(!_custodians_db) _custodians_db.emplace(get_self(), get_self().value );
+      return *_custodians_db;
+    }
+    thresholds_table& thresholds_db(){
+      if(!_thresholds_db) _thresholds_db.emplace(get_self(), get_self().value );
+      return *_thresholds_db;
+    }
+    coreconf_table& coreconf_db(){
+      if(!_coreconf_db) _coreconf_db.emplace(get_self(), get_self().value );
+      return *_coreconf_db;
+    }
+    corestate_table& corestate_db(){
+      if(!_corestate_db) _corestate_db.emplace(get_self(), get_self().value );
+      return *_corestate_db;
+    }
+
     //functions//
     groupconf get_group_conf();
     bool is_account_voice_wrapper(const name& account);
@@ -214,6 +504,8 @@ CONTRACT group : public contract {
     void insert_or_update_or_delete_threshold(const name& threshold_name, const int8_t& threshold, const bool& remove, const bool& privileged);
     void update_thresholds_based_on_number_custodians();
     threshold_name_and_value get_required_threshold_name_and_value_for_contract_action(const name& contract, const name& action_name);
+    threshold_name_and_value get_max_required_threshold(const vector<action>& actions);
+    void open_proposal(const name& proposer, const string& title, const string& description, const vector<action>& actions, const time_point_sec& expiration, const bool& auto_exec, const checksum256& trx_id, const uint64_t& template_id);
     bool is_threshold_linked(const name& threshold_name);
 
     //vector<threshold_name_and_value> get_counts_for
@@ -231,14 +523,49 @@ CONTRACT group : public contract {
     //internal accounting
     void sub_balance(const name& account, const extended_asset& value);
     void add_balance(const name& account, const extended_asset& value);
+    void update_liabilities(const name& account, const extended_asset& delta, const bool& sub);
+    void change_liability_total(const extended_asset& delta, const bool& sub);
+    bool is_token_allowed(const extended_symbol& token, const bool& member_deposit);
+
+    //state digest
+    checksum256 get_member_leaf(const name& account);
+    checksum256 get_balance_leaf(const name& account, const extended_asset& balance);
+    void expand_leaf(const checksum256& leaf, vector<uint64_t>& expanded);
+    void update_digest(const vector<checksum256>& removed, const vector<checksum256>& added);
 
     //proposals
     void delete_proposal(const uint64_t& id);
     void approve_proposal(const uint64_t& id, const name& approver);
+    vector<action> get_proposal_actions(proposals_table::const_iterator& prop_itr);
+    vector<uint64_t> store_payloads(const vector<action>& actions);
+    void release_payloads(const vector<uint64_t>& payload_ids);
+    void add_approvals(proposals_table& idx, proposals_table::const_iterator& prop_itr, const vector<name>& approvers);
+    checksum256 get_approval_digest(proposals_table::const_iterator& prop_itr);
     void assert_invalid_authorization( vector<permission_level> auths);
     void archive_proposal(const name& archive_type, proposals_table& idx, proposals_table::const_iterator& prop_itr);
+    bool update_ready_state(proposals_table::const_iterator& prop_itr);
+    void refresh_ready_proposals(const bool& restart, const uint32_t& max);
+    bool execute_proposal(const name& executer, proposals_table& idx, proposals_table::const_iterator& prop_itr, const uint32_t& max);
+    bool is_exec_started(proposals_table::const_iterator& prop_itr);
+    bool is_exec_started_row(const proposals& prop);
+    bool is_exec_abandoned(const proposals& prop);
 
     bool has_module(const name& module_name);
+    void spawn_child_accounts(const vector<childac_spec>& specs);
+    void remove_child_account(childaccounts_table& idx, childaccounts_table::const_iterator& itr);
+    void insert_child_account(const name& account, name parent, const name& module_name);
+    bool consume_prepaid_resources(const name& to, const extended_asset& value);
+    void send_withdrawal(const name& to, const extended_asset& value);
+    bool consume_pending_withdrawal(const name& to, const extended_asset& value);
+    name get_module_account(const name& module_name);
+    vector<module_binding> get_module_registry();
+    void set_module_binding(const name& module_name, const name& account, const bool& remove);
+
+    //batched jobs
+    uint64_t get_cursor(const name& job);
+    void set_cursor(const name& job, const uint64_t& next_key, const bool& done);
+    void rebuild_idx64_row(const name& table, const uint64_t& scope, const uint64_t& primary, const vector<uint64_t>& keys, const uint8_t& max_slots);
+    void rebuild_idx256_row(const name& table, const uint64_t& scope, const uint64_t& primary, const int8_t& slot, const checksum256& key, const uint8_t& max_slots);
 
     //members
     bool is_member(const name& accountname);
@@ -0,0 +1,140 @@
+#pragma once
+#include <eosio/eosio.hpp>
+#include <eosio/asset.hpp>
+#include <eosio/crypto.hpp>
+#include <eosio/singleton.hpp>
+#include <optional>
+
+//Header only reader for other contracts (modules) that need group state.
+//Reads the group account tables directly, each table is loaded at most once per reader instance.
+//Mirrors of the group tables, keep in sync with include/group.hpp.
+namespace groupreader {
+
+    using namespace eosio;
+    using std::vector;
+    using std::optional;
+
+    struct module_binding{
+        name module_name;
+        name account;
+    };
+
+    struct groupconf{
+        uint8_t max_custodians = 0;
+        uint32_t inactivate_cust_after_sec = 60*60*24*30;
+        bool exec_on_threshold_zero = false;
+        uint8_t proposal_archive_size = 3;
+        bool member_registration = false;
+        bool withdrawals = false;
+        bool internal_transfers = false;
+        bool deposits = false;
+        name maintainer_account = name("eosgroups222");
+    };
+
+    struct coreconf{
+        groupconf conf;
+        binary_extension< vector<module_binding> > modules;
+        binary_extension<checksum256> chain_id;
+    };
+    typedef eosio::singleton<"coreconf"_n, coreconf> coreconf_table;
+
+    struct custodians{
+        name account;
+        name authority;
+        uint8_t weight;
+        time_point_sec joined;
+        time_point_sec last_active;
+        uint64_t primary_key() const { return account.value; }
+    };
+    typedef multi_index<"custodians"_n, custodians> custodians_table;
+
+    struct members{
+        name account;
+        binary_extension<time_point_sec> agreement_date;
+        uint64_t primary_key() const { return account.value; }
+    };
+    typedef multi_index<"members"_n, members> members_table;
+
+    struct balances{
+        extended_asset balance;
+        uint64_t primary_key() const { return balance.quantity.symbol.raw(); }
+    };
+    typedef multi_index<"balances"_n, balances> balances_table;
+
+    class GroupReader{
+        private:
+        name group;
+        optional<coreconf> core;
+        custodians_table _custodians;
+        members_table _members;
+
+        public:
+
+        GroupReader(name group_account):
+            group(group_account),
+            _custodians(group_account, group_account.value),
+            _members(group_account, group_account.value) {}
+
+        const groupconf& get_conf(){
+            if(!core){
+                coreconf_table _coreconf(group, group.value);
+                core = _coreconf.get_or_default(coreconf());
+            }
+            return core->conf;
+        }
+
+        //name(0) when the group has no such module
+        name get_module_account(name module_name){
+            get_conf();
+            if(core->modules.has_value() ){
+                for(const module_binding& mb : core->modules.value() ){
+                    if(mb.module_name == module_name){
+                        return mb.account;
+                    }
+                }
+            }
+            return name(0);
+        }
+
+        bool is_member(name account){
+            if(account == group){
+                return true;
+            }
+            return _members.find(account.value) != _members.end();
+        }
+
+        bool is_custodian(name account){
+            return _custodians.find(account.value) != _custodians.end();
+        }
+
+        //same rule as group::is_account_alive
+        bool is_custodian_alive(name account){
+            auto cust_itr = _custodians.find(account.value);
+            if(cust_itr == _custodians.end() ){
+                return false;
+            }
+            uint32_t inactivate_after = get_conf().inactivate_cust_after_sec;
+            if(inactivate_after == 0){
+                return cust_itr->last_active != time_point_sec(0);
+            }
+            uint32_t inactive_period = current_time_point().sec_since_epoch() - cust_itr->last_active.sec_since_epoch();
+            return inactive_period < inactivate_after;
+        }
+
+        uint8_t get_custodian_weight(name account){
+            auto cust_itr = _custodians.find(account.value);
+            return cust_itr == _custodians.end() ? 0 : cust_itr->weight;
+        }
+
+        //zero when the account holds nothing of this token in the group. balances are keyed by symbol only,
+        //a row of the same symbol issued by another contract is a different token
+        extended_asset get_balance(name account, extended_symbol token){
+            balances_table _balances(group, account.value);
+            auto bal_itr = _balances.find(token.get_symbol().raw() );
+            if(bal_itr == _balances.end() || bal_itr->balance.contract != token.get_contract() ){
+                return extended_asset(0, token);
+            }
+            return bal_itr->balance;
+        }
+    };
+}
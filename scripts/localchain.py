@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+# cleos wrapper for a single local nodeos, shared by ram_ledger.py and workload.py.
+# expects a running nodeos with the producer plugin and a default wallet that holds the eosio development key.
+# CLEOS and NODEOS_URL override the cleos binary and the api endpoint, TOKEN_WASM/TOKEN_ABI point to eosio.token.
+import calendar
+import json
+import os
+import subprocess
+import time
+
+CLEOS = os.environ.get("CLEOS", "cleos")
+URL = os.environ.get("NODEOS_URL", "http://127.0.0.1:8888")
+DEV_KEY = "EOS6MRyAjQq8ud7hVNYcfnVPJqcVpscN5So8BhtHuGYqET5GDW5CV"
+
+class ChainError(Exception):
+  pass
+
+def cleos(*args, parse=True):
+  res = subprocess.run([CLEOS, "-u", URL] + [str(a) for a in args], capture_output=True, text=True)
+  if res.returncode != 0:
+    raise ChainError(res.stderr.strip() or res.stdout.strip())
+  return json.loads(res.stdout) if parse else res.stdout
+
+def push(contract, action, data, actor, permission="active"):
+  #returns the transaction trace, the caller reads billed cpu and receipts from it
+  return cleos("push", "action", contract, action, json.dumps(data), "-p", actor + "@" + permission, "-j", "-f")
+
+def admin(group, action, data):
+  #group authorized actions. owner keeps the deploy key, update_active hands active to the custodians
+  return push(group, action, data, group, "owner")
+
+def account_exists(account):
+  try:
+    cleos("get", "account", account, "-j")
+    return True
+  except ChainError:
+    return False
+
+def create_account(account, creator="eosio"):
+  if not account_exists(account):
+    cleos("create", "account", creator, account, DEV_KEY, DEV_KEY, parse=False)
+
+def ram_usage(account):
+  return cleos("get", "account", account, "-j")["ram_usage"]
+
+def head_block_num():
+  return cleos("get", "info")["head_block_num"]
+
+def wait_blocks(count=1):
+  start = head_block_num()
+  while head_block_num() < start + count:
+    time.sleep(0.1)
+
+def account_name(prefix, n, width=4):
+  #numbered account names, a-z only so they stay valid eosio names
+  suffix = ""
+  for _ in range(width):
+    suffix = chr(ord("a") + n % 26) + suffix
+    n //= 26
+  return prefix + suffix
+
+def set_contract(account, wasm, abi):
+  try:
+    cleos("set", "contract", account, os.path.dirname(os.path.abspath(wasm)), os.path.basename(wasm), os.path.basename(abi), "-j")
+  except ChainError as e:
+    if "already running this version" not in str(e):
+      raise
+
+def setup_token(symbol="EOS", supply="1000000000.0000"):
+  create_account("eosio.token")
+  set_contract("eosio.token", os.environ["TOKEN_WASM"], os.environ["TOKEN_ABI"])
+  try:
+    push("eosio.token", "create", {"issuer": "eosio", "maximum_supply": supply + " " + symbol}, "eosio.token")
+  except ChainError as e:
+    if "already exists" not in str(e):
+      raise
+
+def issue(to, quantity):
+  push("eosio.token", "issue", {"to": "eosio", "quantity": quantity, "memo": ""}, "eosio")
+  if to != "eosio":
+    push("eosio.token", "transfer", {"from": "eosio", "to": to, "quantity": quantity, "memo": ""}, "eosio")
+
+def deploy_group(group, wasm, abi):
+  create_account(group)
+  create_account("eosgroups222")#messagebus receiver, an account without code accepts the notifications
+  set_contract(group, wasm, abi)
+  #inline actions of the group are sent with its owner permission
+  auth = {"threshold": 1, "keys": [{"key": DEV_KEY, "weight": 1}], "accounts": [{"permission": {"actor": group, "permission": "eosio.code"}, "weight": 1}], "waits": []}
+  for perm, parent in (("active", "owner"), ("owner", "")):
+    cleos("set", "account", "permission", group, perm, json.dumps(auth), parent, "-j", "-p", group + "@owner")
+
+def groupconf(**overrides):
+  conf = {
+    "max_custodians": 0,
+    "inactivate_cust_after_sec": 60*60*24*30,
+    "exec_on_threshold_zero": False,
+    "proposal_archive_size": 3,
+    "member_registration": True,
+    "withdrawals": True,
+    "internal_transfers": True,
+    "deposits": True,
+    "maintainer_account": "eosgroups222",
+  }
+  conf.update(overrides)
+  return conf
+
+def setup_group(group, wasm, abi, custodians, members, threshold=None, symbol="EOS", deposit="100.0000", **conf):
+  #group with the given custodians and funded members. the default threshold follows the custodian count (update_active),
+  #with threshold set eosio.token::transfer is linked to an "xfer" threshold of that value instead
+  setup_token(symbol)
+  deploy_group(group, wasm, abi)
+  admin(group, "updateconf", {"new_conf": groupconf(**conf), "remove": False})
+  admin(group, "mantoken", {"token": {"sym": "4," + symbol, "contract": "eosio.token"}, "remove": False})
+  admin(group, "syncliabs", {"batch_size": 1})
+  for cust in custodians:
+    create_account(cust)
+    admin(group, "invitecust", {"account": cust})
+    push(group, "imalive", {"account": cust}, cust)
+  if threshold:
+    admin(group, "manthreshold", {"threshold_name": "xfer", "threshold": threshold, "remove": False})
+    admin(group, "manthreshlin", {"contract": "eosio.token", "action_name": "transfer", "threshold_name": "xfer", "remove": False})
+  for member in members:
+    create_account(member)
+    push(group, "regmember", {"actor": member}, member)
+    if deposit:
+      fund_member(group, member, deposit + " " + symbol)
+
+def fund_member(group, member, quantity):
+  issue("eosio", quantity)
+  push("eosio.token", "transfer", {"from": "eosio", "to": group, "quantity": quantity, "memo": "add to user account: " + member}, "eosio")
+
+def transfer_action(group, to, quantity):
+  #proposal payload: transfer out of the group's own balance. the group sends it with owner, active belongs to the custodians
+  return {
+    "account": "eosio.token",
+    "name": "transfer",
+    "authorization": [{"actor": group, "permission": "owner"}],
+    "data": {"from": group, "to": to, "quantity": quantity, "memo": ""},
+  }
+
+def pack_actions(actions):
+  #cleos packs the action data for us, the group expects hex data in the proposal
+  packed = []
+  for act in actions:
+    data = cleos("convert", "pack_action_data", act["account"], act["name"], json.dumps(act["data"]), parse=False).strip()
+    packed.append(dict(act, data=data))
+  return packed
+
+def name_value(account):
+  #eosio name encoding: 12 chars of 5 bits, a 13th of 4 bits
+  value = 0
+  for i in range(13):
+    c = account[i] if i < len(account) else "."
+    sym = 0 if c == "." else (ord(c) - ord("1") + 1 if "1" <= c <= "5" else ord(c) - ord("a") + 6)
+    value |= (sym & 0x1f) << (64 - 5 * (i + 1) ) if i < 12 else sym & 0x0f
+  return value
+
+def varuint(n):
+  out = bytearray()
+  while True:
+    b = n & 0x7f
+    n >>= 7
+    out.append(b | (0x80 if n else 0) )
+    if not n:
+      return bytes(out)
+
+def pack_action_vector(actions):
+  #packed vector<action> for propappend, actions as returned by pack_actions
+  out = bytearray(varuint(len(actions) ) )
+  for act in actions:
+    out += name_value(act["account"]).to_bytes(8, "little") + name_value(act["name"]).to_bytes(8, "little")
+    out += varuint(len(act["authorization"]) )
+    for auth in act["authorization"]:
+      out += name_value(auth["actor"]).to_bytes(8, "little") + name_value(auth["permission"]).to_bytes(8, "little")
+    data = bytes.fromhex(act["data"])
+    out += varuint(len(data) ) + data
+  return out.hex()
+
+def expiration(seconds):
+  info = cleos("get", "info")
+  head = calendar.timegm(time.strptime(info["head_block_time"].split(".")[0], "%Y-%m-%dT%H:%M:%S"))
+  return time.strftime("%Y-%m-%dT%H:%M:%S", time.gmtime(head + seconds))
+
+def last_proposal_id(group):
+  rows = cleos("get", "table", group, group, "proposals", "-r", "-l", "1")["rows"]
+  return rows[0]["id"] if rows else None
+
+def billed_cpu_us(trace):
+  return trace["processed"]["receipt"]["cpu_usage_us"]
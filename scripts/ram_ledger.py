@@ -0,0 +1,248 @@
+#!/usr/bin/env python3
+# RAM delta per action, checked against the ledger in ram_ledger.json.
+# every scenario runs its setup first, then measures ram_usage of each payer around the action under test.
+# the deltas are steady state: the tables and scopes the action writes to already exist, except where the
+# scenario says otherwise. use a fresh group account per run, and a wasm/abi built from this tree with eosio-cdt 1.6.2.
+#
+#   python3 scripts/ram_ledger.py check --group mygroup --wasm build/group.wasm --abi build/group.abi
+#   python3 scripts/ram_ledger.py record --group mygroup --wasm build/group.wasm --abi build/group.abi
+import argparse
+import json
+import os
+import sys
+
+import localchain as lc
+
+LEDGER = os.path.join(os.path.dirname(os.path.abspath(__file__)), "ram_ledger.json")
+SYMBOL = "EOS"
+CUSTODIANS = ["rlcusta", "rlcustb", "rlcustc"]
+MEMBERS = ["rlmema", "rlmemb"]
+
+class Names:
+  #fresh account names per run
+  def __init__(self, prefix):
+    self.prefix = prefix
+    self.count = 0
+
+  def next(self):
+    self.count += 1
+    return lc.account_name(self.prefix, self.count - 1)
+
+def qty(amount):
+  return "%.4f %s" % (amount, SYMBOL)
+
+def payload(group):
+  return lc.pack_actions([lc.transfer_action(group, MEMBERS[0], qty(0.0001) )])
+
+def open_proposal(group):
+  data = {"proposer": CUSTODIANS[0], "title": "t", "description": "", "actions": payload(group), "expiration": lc.expiration(60*60*24)}
+  lc.push(group, "propose", data, CUSTODIANS[0])
+  return lc.last_proposal_id(group)
+
+def open_ready_proposal(ctx):
+  group = ctx["group"]
+  pid = open_proposal(group)
+  lc.push(group, "approve", {"approver": CUSTODIANS[1], "id": pid}, CUSTODIANS[1])
+  return pid
+
+def open_draft(group, proposer):
+  lc.push(group, "propstart", {"proposer": proposer, "title": "t", "description": ""}, proposer)
+  draft_id = lc.cleos("get", "table", group, group, "drafts", "-r", "-l", "1")["rows"][0]["id"]
+  lc.push(group, "propappend", {"proposer": proposer, "draft_id": draft_id, "chunk": lc.pack_action_vector(payload(group) )}, proposer)
+  return draft_id
+
+def child_spec(account):
+  zero = qty(0)
+  return {"new_account": account, "ram_amount": zero, "net_amount": zero, "cpu_amount": zero, "parent": "", "module_name": ""}
+
+#each scenario returns (payers, run): payers maps a ledger role to an account, run performs the measured action
+def sc_regmember(ctx):
+  member = ctx["names"].next()
+  lc.create_account(member)
+  return {"member": member, "group": ctx["group"]}, lambda: lc.push(ctx["group"], "regmember", {"actor": member}, member)
+
+def sc_unregmember(ctx):
+  member = ctx["names"].next()
+  lc.create_account(member)
+  lc.push(ctx["group"], "regmember", {"actor": member}, member)
+  return {"member": member, "group": ctx["group"]}, lambda: lc.push(ctx["group"], "unregmember", {"actor": member}, member)
+
+def sc_deposit_first(ctx):
+  #the member's balances scope doesn't exist yet, the delta includes the new scope
+  member = ctx["names"].next()
+  lc.create_account(member)
+  lc.push(ctx["group"], "regmember", {"actor": member}, member)
+  return {"member": member, "group": ctx["group"]}, lambda: lc.fund_member(ctx["group"], member, qty(1) )
+
+def sc_internalxfr_new_receiver(ctx):
+  member = ctx["names"].next()
+  lc.create_account(member)
+  lc.push(ctx["group"], "regmember", {"actor": member}, member)
+  data = {"from": MEMBERS[0], "to": member, "amount": {"quantity": qty(1), "contract": "eosio.token"}, "msg": ""}
+  return {"member": member, "group": ctx["group"]}, lambda: lc.push(ctx["group"], "internalxfr", data, MEMBERS[0])
+
+def sc_widthdraw_all(ctx):
+  #the member already holds the token on eosio.token, so the transfer out doesn't create a token row
+  member = ctx["names"].next()
+  lc.create_account(member)
+  lc.issue(member, qty(1) )
+  lc.push(ctx["group"], "regmember", {"actor": member}, member)
+  lc.fund_member(ctx["group"], member, qty(1) )
+  data = {"account": member, "amount": {"quantity": qty(1), "contract": "eosio.token"}}
+  return {"member": member, "group": ctx["group"]}, lambda: lc.push(ctx["group"], "widthdraw", data, member)
+
+def sc_propose(ctx):
+  group = ctx["group"]
+  actions = lc.pack_actions([lc.transfer_action(group, MEMBERS[0], qty(0.0001) )])
+  data = {"proposer": CUSTODIANS[0], "title": "t", "description": "", "actions": actions, "expiration": lc.expiration(60*60*24)}
+  return {"proposer": CUSTODIANS[0], "group": group}, lambda: lc.push(group, "propose", data, CUSTODIANS[0])
+
+def sc_approve_ready(ctx):
+  group = ctx["group"]
+  pid = open_proposal(group)
+  return {"approver": CUSTODIANS[1], "group": group}, lambda: lc.push(group, "approve", {"approver": CUSTODIANS[1], "id": pid}, CUSTODIANS[1])
+
+def sc_exec_archive(ctx):
+  group = ctx["group"]
+  pid = open_ready_proposal(ctx)
+  return {"executer": CUSTODIANS[2], "group": group}, lambda: lc.push(group, "exec", {"executer": CUSTODIANS[2], "id": pid}, CUSTODIANS[2])
+
+def sc_crank(ctx):
+  #one ready proposal executed by the keeper, same rows as exec
+  group = ctx["group"]
+  open_ready_proposal(ctx)
+  return {"group": group}, lambda: lc.push(group, "crank", {"max_proposals": 1}, CUSTODIANS[2])
+
+def sc_cancel(ctx):
+  #moves the row to the cancelled archive, which setup already created
+  group = ctx["group"]
+  pid = open_proposal(group)
+  return {"proposer": CUSTODIANS[0], "group": group}, lambda: lc.push(group, "cancel", {"canceler": CUSTODIANS[0], "id": pid}, CUSTODIANS[0])
+
+def sc_propseal(ctx):
+  #the draft is refunded to the proposer, the proposal is paid by the group. setup keeps another draft open
+  group = ctx["group"]
+  draft_id = open_draft(group, CUSTODIANS[0])
+  data = {"proposer": CUSTODIANS[0], "draft_id": draft_id, "expiration": lc.expiration(60*60*24), "auto_exec": False}
+  return {"proposer": CUSTODIANS[0], "group": group}, lambda: lc.push(group, "propseal", data, CUSTODIANS[0])
+
+def sc_spawnchilds(ctx):
+  #zero resource amounts, a local chain without the system contract only has the native newaccount
+  account = ctx["names"].next()
+  return {"group": ctx["group"]}, lambda: lc.admin(ctx["group"], "spawnchilds", {"specs": [child_spec(account)]})
+
+def sc_compactmems(ctx):
+  #rows written by this build are already compact, the job only walks them and drops its cursor
+  return {"group": ctx["group"]}, lambda: lc.admin(ctx["group"], "compactmems", {"batch_size": 100})
+
+def sc_regmembers(ctx):
+  accounts = [ctx["names"].next(), ctx["names"].next()]
+  for account in accounts:
+    lc.create_account(account)
+  return {"group": ctx["group"]}, lambda: lc.admin(ctx["group"], "regmembers", {"accounts": accounts, "payer": ctx["group"]})
+
+def sc_setapprkey(ctx):
+  cust = CUSTODIANS[2]
+  return {"custodian": cust, "group": ctx["group"]}, lambda: lc.push(ctx["group"], "setapprkey", {"account": cust, "key": lc.DEV_KEY}, cust)
+
+def sc_mantoken(ctx):
+  data = {"token": {"sym": "4,TST", "contract": "eosio.token"}, "remove": False}
+  return {"group": ctx["group"]}, lambda: lc.admin(ctx["group"], "mantoken", data)
+
+def sc_mantemplate(ctx):
+  #first template, the delta includes the new proptemplate table
+  group = ctx["group"]
+  data = {"template_id": 0, "title": "t", "description": "", "actions": payload(group), "remove": False}
+  return {"group": group}, lambda: lc.admin(group, "mantemplate", data)
+
+def sc_proposetpl(ctx):
+  #runs after mantemplate, template 0 exists
+  data = {"proposer": CUSTODIANS[0], "template_id": 0, "expiration": lc.expiration(60*60*24)}
+  return {"proposer": CUSTODIANS[0], "group": ctx["group"]}, lambda: lc.push(ctx["group"], "proposetpl", data, CUSTODIANS[0])
+
+SCENARIOS = [
+  ("regmember", sc_regmember),
+  ("unregmember", sc_unregmember),
+  ("deposit_first", sc_deposit_first),
+  ("internalxfr_new_receiver", sc_internalxfr_new_receiver),
+  ("widthdraw_all", sc_widthdraw_all),
+  ("propose", sc_propose),
+  ("approve_ready", sc_approve_ready),
+  ("exec_archive", sc_exec_archive),
+  ("crank", sc_crank),
+  ("cancel", sc_cancel),
+  ("propseal", sc_propseal),
+  ("setapprkey", sc_setapprkey),
+  ("mantoken", sc_mantoken),
+  ("mantemplate", sc_mantemplate),
+  ("proposetpl", sc_proposetpl),
+  ("spawnchilds", sc_spawnchilds),
+  ("compactmems", sc_compactmems),
+  ("regmembers", sc_regmembers),
+]
+
+def setup(args):
+  group = args.group
+  #3 custodians give a default threshold of 2, the archive is large enough that no scenario truncates it
+  lc.setup_group(group, args.wasm, args.abi, CUSTODIANS, MEMBERS, proposal_archive_size=50)
+  lc.issue(MEMBERS[0], qty(1) )#proposal transfers go to an account that already holds the token
+  lc.issue("eosio", qty(10) )
+  lc.push("eosio.token", "transfer", {"from": "eosio", "to": group, "quantity": qty(10), "memo": ""}, "eosio")
+  #create every table and scope the steady state scenarios write to:
+  #executed and cancelled archives, an open ready proposal, another custodian's draft, a child account + prepaid_resources
+  pid = open_ready_proposal({"group": group})
+  lc.push(group, "exec", {"executer": CUSTODIANS[0], "id": pid}, CUSTODIANS[0])
+  pid = open_proposal(group)
+  lc.push(group, "cancel", {"canceler": CUSTODIANS[0], "id": pid}, CUSTODIANS[0])
+  open_ready_proposal({"group": group})
+  open_draft(group, CUSTODIANS[2])
+  lc.admin(group, "spawnchilds", {"specs": [child_spec("rlchild")]})
+
+def measure(args):
+  setup(args)
+  ctx = {"group": args.group, "names": Names("rln")}
+  result = {}
+  for key, scenario in SCENARIOS:
+    payers, run = scenario(ctx)
+    before = {role: lc.ram_usage(account) for role, account in payers.items()}
+    run()
+    result[key] = {role: lc.ram_usage(account) - before[role] for role, account in payers.items()}
+  return result
+
+def main():
+  parser = argparse.ArgumentParser(description="RAM delta per action, checked against " + os.path.basename(LEDGER) )
+  parser.add_argument("mode", choices=["check", "record"])
+  parser.add_argument("--group", required=True, help="fresh account name for the group")
+  parser.add_argument("--wasm", required=True, help="built from this tree, the checked-in group.wasm predates it")
+  parser.add_argument("--abi", required=True)
+  args = parser.parse_args()
+
+  measured = measure(args)
+  with open(LEDGER) as f:
+    ledger = json.load(f)
+
+  if args.mode == "record":
+    ledger["scenarios"] = measured
+    ledger["source"] = "measured"
+    with open(LEDGER, "w") as f:
+      json.dump(ledger, f, indent=2, sort_keys=True)
+      f.write("\n")
+    print("recorded %d scenarios" % len(measured) )
+    return 0
+
+  if ledger.get("source") != "measured":
+    print("ledger values are computed, not measured. run record once to check in measured values")
+  grown = []
+  for key, deltas in measured.items():
+    expected = ledger["scenarios"].get(key, {})
+    for role, delta in deltas.items():
+      print("%-26s %-10s %6d bytes (ledger %s)" % (key, role, delta, expected.get(role, "-") ) )
+      if role not in expected or delta > expected[role]:
+        grown.append("%s/%s" % (key, role) )
+  if grown:
+    print("RAM delta grew: " + ", ".join(grown) )
+    return 1
+  return 0
+
+if __name__ == "__main__":
+  sys.exit(main() )
@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+# reference workload from the README, replayed against a single local nodeos.
+# sets up a group with N custodians and M funded members, then runs the action mix from --workers threads for
+# --duration seconds and writes the report as json (--out) and as a text table on stdout.
+# imalive and isetcusts run on a compressed schedule (--imalive-every, --election-every) so short runs include them.
+#
+#   python3 scripts/workload.py --group mygroup --wasm build/group.wasm --abi build/group.abi --custodians 5 --members 100 --out n5m100.json
+import argparse
+import calendar
+import concurrent.futures
+import json
+import random
+import sys
+import threading
+import time
+
+import localchain as lc
+
+SYMBOL = "EOS"
+ELECTIONS = "rwelections"
+
+#weights of the randomly picked operations, a proposal counts its propose, approve and exec actions separately
+MIX = [
+  ("deposit", 30),
+  ("internalxfr", 40),
+  ("proposal", 10),
+]
+
+def qty(amount):
+  return "%.4f %s" % (amount, SYMBOL)
+
+def block_time(trace):
+  stamp = trace["processed"]["block_time"]
+  seconds, _, fraction = stamp.partition(".")
+  return calendar.timegm(time.strptime(seconds, "%Y-%m-%dT%H:%M:%S") ) + float("0." + (fraction or "0") )
+
+def percentile(values, p):
+  if not values:
+    return None
+  ordered = sorted(values)
+  return ordered[min(len(ordered) - 1, int(round(p / 100.0 * (len(ordered) - 1) ) ) )]
+
+class Run:
+  def __init__(self, args):
+    self.args = args
+    self.group = args.group
+    self.custodians = [lc.account_name("rwcust", i, 3) for i in range(args.custodians)]
+    self.members = [lc.account_name("rwmem", i, 3) for i in range(args.members)]
+    self.threshold = args.threshold or args.custodians // 2 + 1
+    self.samples = []
+    self.lock = threading.Lock()
+    self.next_imalive = 0
+    self.next_election = 0
+
+  def setup(self):
+    lc.setup_group(self.group, self.args.wasm, self.args.abi, self.custodians, self.members, threshold=self.threshold,
+      symbol=SYMBOL, deposit="100.0000", max_custodians=len(self.custodians) )
+    lc.create_account(ELECTIONS)
+    lc.admin(self.group, "addchildac", {"account": ELECTIONS, "parent": self.group, "module_name": "elections"})
+    #group balance for the proposal transfers, receivers already hold the token. eosio funds the deposits
+    lc.issue("eosio", qty(1000000) )
+    lc.push("eosio.token", "transfer", {"from": "eosio", "to": self.group, "quantity": qty(1000), "memo": ""}, "eosio")
+    for member in self.members:
+      lc.issue(member, qty(0.0001) )
+
+  def push(self, action, data, actor, contract=None, label=None):
+    #one sample per action: billed cpu, and the time until the block that includes it
+    contract = contract or self.group
+    action_label = label or action
+    submitted = time.time()
+    try:
+      trace = lc.push(contract, action, data, actor)
+    except lc.ChainError as e:
+      with self.lock:
+        self.samples.append({"action": action_label, "ok": False, "error": str(e).splitlines()[-1] if str(e) else ""})
+      return None
+    returned = time.time()
+    with self.lock:
+      self.samples.append({
+        "action": action_label,
+        "ok": True,
+        "cpu_us": lc.billed_cpu_us(trace),
+        "latency_ms": max(block_time(trace), returned) * 1000 - submitted * 1000,
+      })
+    return trace
+
+  def deposit(self, rnd):
+    member = rnd.choice(self.members)
+    data = {"from": "eosio", "to": self.group, "quantity": qty(0.0001), "memo": "add to user account: " + member}
+    self.push("transfer", data, "eosio", contract="eosio.token", label="deposit")
+
+  def internalxfr(self, rnd):
+    sender, receiver = rnd.sample(self.members, 2)
+    data = {"from": sender, "to": receiver, "amount": {"quantity": qty(0.0001), "contract": "eosio.token"}, "msg": ""}
+    self.push("internalxfr", data, sender)
+
+  def proposal(self, rnd):
+    count = rnd.randint(1, 7)
+    actions = lc.pack_actions([lc.transfer_action(self.group, rnd.choice(self.members), qty(0.0001) ) for _ in range(count)])
+    custs = rnd.sample(self.custodians, self.threshold)
+    data = {"proposer": custs[0], "title": "workload", "description": "", "actions": actions, "expiration": lc.expiration(60*60*24)}
+    trace = self.push("propose", data, custs[0])
+    if trace is None:
+      return
+    pid = self.proposal_id(trace, custs[0])
+    for cust in custs[1:]:
+      self.push("approve", {"approver": cust, "id": pid}, cust)
+    self.push("exec", {"executer": custs[0], "id": pid}, custs[0])
+
+  def proposal_id(self, trace, actor):
+    #other workers propose concurrently, look the row up by this transaction's id. not sampled
+    lookup = lc.push(self.group, "findbytrx", {"trx_id": trace["transaction_id"]}, actor)
+    console = lookup["processed"]["action_traces"][0]["console"]
+    return int(console.split("id:")[1].split(" ")[0])
+
+  def scheduled(self, now):
+    #imalive and isetcusts, run by whichever worker sees them due first
+    with self.lock:
+      imalive = now >= self.next_imalive
+      election = now >= self.next_election
+      if imalive:
+        self.next_imalive = now + self.args.imalive_every
+      if election:
+        self.next_election = now + self.args.election_every
+    if imalive:
+      for cust in self.custodians:
+        self.push("imalive", {"account": cust}, cust)
+    if election:
+      self.push("isetcusts", {"accounts": self.custodians}, ELECTIONS)
+
+  def worker(self, seed):
+    rnd = random.Random(seed)
+    ops = [op for op, weight in MIX for _ in range(weight)]
+    end = self.started + self.args.duration
+    while time.time() < end:
+      self.scheduled(time.time() )
+      getattr(self, rnd.choice(ops) )(rnd)
+
+  def run(self):
+    self.started = time.time()
+    with concurrent.futures.ThreadPoolExecutor(self.args.workers) as pool:
+      list(pool.map(self.worker, [self.args.seed + i for i in range(self.args.workers)]) )
+    self.elapsed = time.time() - self.started
+
+  def report(self):
+    ok = [s for s in self.samples if s["ok"]]
+    per_action = {}
+    for action in sorted(set(s["action"] for s in self.samples) ):
+      rows = [s for s in ok if s["action"] == action]
+      cpu = [s["cpu_us"] for s in rows]
+      latency = [s["latency_ms"] for s in rows]
+      per_action[action] = {
+        "count": len(rows),
+        "failed": len([s for s in self.samples if s["action"] == action and not s["ok"]]),
+        "cpu_us_mean": round(sum(cpu) / len(cpu), 1) if cpu else None,
+        "cpu_us_p50": percentile(cpu, 50),
+        "cpu_us_p99": percentile(cpu, 99),
+        "latency_ms_p50": percentile(latency, 50),
+        "latency_ms_p99": percentile(latency, 99),
+      }
+    latency = [s["latency_ms"] for s in ok]
+    return {
+      "params": {
+        "custodians": len(self.custodians),
+        "members": len(self.members),
+        "threshold": self.threshold,
+        "duration_sec": self.args.duration,
+        "workers": self.args.workers,
+        "seed": self.args.seed,
+      },
+      "elapsed_sec": round(self.elapsed, 1),
+      "actions": len(ok),
+      "failed": len(self.samples) - len(ok),
+      "actions_per_sec": round(len(ok) / self.elapsed, 2),
+      "latency_ms_p50": percentile(latency, 50),
+      "latency_ms_p99": percentile(latency, 99),
+      "per_action": per_action,
+    }
+
+def print_report(report):
+  p = report["params"]
+  print("custodians %d, members %d, threshold %d, %d workers, %.1f s" % (p["custodians"], p["members"], p["threshold"], p["workers"], report["elapsed_sec"]) )
+  print("%.2f actions/s, %d ok, %d failed, latency p50 %s ms, p99 %s ms" % (report["actions_per_sec"], report["actions"], report["failed"],
+    fmt(report["latency_ms_p50"]), fmt(report["latency_ms_p99"]) ) )
+  print("%-12s %7s %7s %9s %9s %9s %11s %11s" % ("action", "count", "failed", "cpu mean", "cpu p50", "cpu p99", "lat p50 ms", "lat p99 ms") )
+  for action, row in report["per_action"].items():
+    print("%-12s %7d %7d %9s %9s %9s %11s %11s" % (action, row["count"], row["failed"], fmt(row["cpu_us_mean"]), fmt(row["cpu_us_p50"]),
+      fmt(row["cpu_us_p99"]), fmt(row["latency_ms_p50"]), fmt(row["latency_ms_p99"]) ) )
+
+def fmt(value):
+  if value is None:
+    return "-"
+  return "%.0f" % value if isinstance(value, float) else str(value)
+
+def main():
+  parser = argparse.ArgumentParser(description="replay the reference workload against a local nodeos")
+  parser.add_argument("--group", required=True, help="group account, created and deployed unless --skip-setup")
+  parser.add_argument("--wasm", required=True, help="built from this tree, the checked-in group.wasm predates it")
+  parser.add_argument("--abi", required=True)
+  parser.add_argument("--custodians", type=int, default=5)
+  parser.add_argument("--members", type=int, default=50)
+  parser.add_argument("--threshold", type=int, default=0, help="approvals for the proposal transfers, a majority of the custodians when 0")
+  parser.add_argument("--duration", type=int, default=60)
+  parser.add_argument("--workers", type=int, default=4)
+  parser.add_argument("--imalive-every", type=int, default=30)
+  parser.add_argument("--election-every", type=int, default=60)
+  parser.add_argument("--seed", type=int, default=1)
+  parser.add_argument("--skip-setup", action="store_true")
+  parser.add_argument("--out", help="write the json report here")
+  args = parser.parse_args()
+  if args.members < 2 or args.custodians < 1:
+    parser.error("need at least 2 members and 1 custodian")
+
+  run = Run(args)
+  if not args.skip_setup:
+    run.setup()
+  run.run()
+  report = run.report()
+  print_report(report)
+  if args.out:
+    with open(args.out, "w") as f:
+      json.dump(report, f, indent=2)
+      f.write("\n")
+  return 0
+
+if __name__ == "__main__":
+  sys.exit(main() )
@@ -4,7 +4,7 @@
 ACTION group::updateconf(groupconf new_conf, bool remove){
     require_auth(get_self());
 
-    coreconf_table _coreconf(get_self(), get_self().value);
+    coreconf_table& _coreconf = coreconf_db();
     if(remove){
       _coreconf.remove();
       return;
@@ -19,70 +19,109 @@ ACTION group::updateconf(groupconf new_conf, bool remove){
 
 
 ///////////////////////////////////
-ACTION group::propose(name proposer, string title, string description, vector<action> actions, time_point_sec expiration) {
+//auto_exec is optional so callers built against the old propose signature keep working
+ACTION group::propose(name proposer, string title, string description, vector<action> actions, time_point_sec expiration, binary_extension<bool> auto_exec) {
   require_auth(proposer);
   check(is_custodian(proposer, true, true), "You can't propose group actions because you are not a custodian.");
-  time_point_sec now = time_point_sec(current_time_point());
+  open_proposal(proposer, title, description, actions, expiration, auto_exec.value_or(false), get_trx_id(), NO_TEMPLATE);
+}
 
-  //validate actions
-  check(actions.size() > 0 && actions.size() < 8, "Number of actions not allowed.");
+//staged proposals: propstart + propappend chunks of a packed vector<action> + propseal
+ACTION group::propstart(name proposer, string title, string description) {
+  require_auth(proposer);
+  check(is_custodian(proposer, true, true), "You can't propose group actions because you are not a custodian.");
+  drafts_table _drafts(get_self(), get_self().value);
+  _drafts.emplace(proposer, [&](auto& n) {
+    n.id = _drafts.available_primary_key();
+    n.proposer = proposer;
+    n.title = title;
+    n.description = description;
+    n.trx_id = get_trx_id();
+  });
+}
 
-  //find  max required threshold + assert when get_self@owner isn't in the authorization
-  threshold_name_and_value max_required_threshold;
-  for (std::vector<int>::size_type i = 0; i != actions.size(); i++){
-    threshold_name_and_value tnav = get_required_threshold_name_and_value_for_contract_action(actions[i].account, actions[i].name);
-    check(tnav.threshold >= 0, "Action is blocked via negative threshold");
-    if(i==0){
-      max_required_threshold = tnav;
-    }
-    else if(tnav.threshold > max_required_threshold.threshold){
-      max_required_threshold = tnav;
-    }
-  }
+ACTION group::propappend(name proposer, uint64_t draft_id, vector<char> chunk) {
+  require_auth(proposer);
+  check(is_custodian(proposer, true, true), "You can't propose group actions because you are not a custodian.");
+  check(chunk.size() > 0, "Empty chunk.");
+  check(chunk.size() <= MAX_DRAFT_CHUNK_BYTES, "Chunk exceeds the maximum size.");
+  drafts_table _drafts(get_self(), get_self().value);
+  auto draft_itr = _drafts.find(draft_id);
+  check(draft_itr != _drafts.end(), "Draft not found.");
+  check(draft_itr->proposer == proposer, "This is not your draft.");
+  check(draft_itr->packed_actions.size() + chunk.size() <= MAX_DRAFT_BYTES, "Draft exceeds the maximum size.");
+  _drafts.modify( draft_itr, same_payer, [&]( auto& n) {
+      n.packed_actions.insert(n.packed_actions.end(), chunk.begin(), chunk.end() );
+  });
+}
 
-  groupconf conf = get_group_conf();
-  if(max_required_threshold.threshold == 0 && conf.exec_on_threshold_zero ){
-    //immediate execution, no signatures needed
-    for(action act : actions) { 
-        act.send();
-    }
-    return;
-  }
+ACTION group::propseal(name proposer, uint64_t draft_id, time_point_sec expiration, bool auto_exec) {
+  require_auth(proposer);
+  check(is_custodian(proposer, true, true), "You can't propose group actions because you are not a custodian.");
+  drafts_table _drafts(get_self(), get_self().value);
+  auto draft_itr = _drafts.find(draft_id);
+  check(draft_itr != _drafts.end(), "Draft not found.");
+  check(draft_itr->proposer == proposer, "This is not your draft.");
+
+  vector<action> actions = unpack< vector<action> >(draft_itr->packed_actions);
+  open_proposal(proposer, draft_itr->title, draft_itr->description, actions, expiration, auto_exec, draft_itr->trx_id, NO_TEMPLATE);
+  _drafts.erase(draft_itr);
+}
 
-  //validate expiration
-  check( now < expiration, "Expiration must be in the future.");
-  uint32_t seconds_left = expiration.sec_since_epoch() - now.sec_since_epoch();
-  check(seconds_left >= 60*60, "Minimum expiration not met.");
+ACTION group::propdiscard(name proposer, uint64_t draft_id) {
+  require_auth(proposer);
+  drafts_table _drafts(get_self(), get_self().value);
+  auto draft_itr = _drafts.find(draft_id);
+  check(draft_itr != _drafts.end(), "Draft not found.");
+  check(draft_itr->proposer == proposer, "This is not your draft.");
+  _drafts.erase(draft_itr);
+}
 
-  name ram_payer = get_self();
+ACTION group::proposetpl(name proposer, uint64_t template_id, time_point_sec expiration) {
+  require_auth(proposer);
+  check(is_custodian(proposer, true, true), "You can't propose group actions because you are not a custodian.");
+  proptemplates_table _proptemplates(get_self(), get_self().value);
+  auto tpl_itr = _proptemplates.find(template_id);
+  check(tpl_itr != _proptemplates.end(), "Template not found.");
+  open_proposal(proposer, tpl_itr->title, tpl_itr->description, tpl_itr->actions, expiration, false, get_trx_id(), template_id);
+}
 
-  proposals_table _proposals(get_self(), get_self().value);
-  _proposals.emplace(ram_payer, [&](auto& n) {
-    n.id = _proposals.available_primary_key();
-    n.proposer = proposer;
-    n.actions = actions;
-    n.approvals = {proposer};
-    n.expiration = expiration;
-    n.submitted = now;
-    n.description = description;
-    n.title = title;
-    n.last_actor = proposer;
-    n.trx_id = get_trx_id();
-    n.required_threshold = max_required_threshold.threshold_name;
-  });
+ACTION group::mantemplate(uint64_t template_id, string title, string description, vector<action> actions, bool remove){
+  require_auth(get_self());
+  proptemplates_table _proptemplates(get_self(), get_self().value);
+  auto tpl_itr = _proptemplates.find(template_id);
 
-  if(true){
-  //messagebus(name sender_group, name event, string message)
-    string msg  = "New proposal by "+proposer.to_string();
-    action(
-        permission_level{ get_self(), "owner"_n },
-        name("eosgroups222"),
-        "messagebus"_n,
-        std::make_tuple(get_self(), name("propose"), msg )
-    ).send();
+  if(remove){
+    check(tpl_itr != _proptemplates.end(), "Template not found.");
+    check(tpl_itr->open_proposals == 0, "Template is used by open proposals.");
+    _proptemplates.erase(tpl_itr);
+    return;
   }
 
+  check(actions.size() > 0 && actions.size() <= MAX_PROPOSAL_ACTIONS, "Number of actions not allowed.");
+  threshold_name_and_value max_required_threshold = get_max_required_threshold(actions);
+
+  if(tpl_itr == _proptemplates.end() ){
+    check(template_id != NO_TEMPLATE, "Invalid template id.");//marks proposals without a template
+    _proptemplates.emplace( get_self(), [&]( auto& n){
+      n.id = template_id;
+      n.title = title;
+      n.description = description;
+      n.actions = actions;
+      n.required_threshold = max_required_threshold.threshold_name;
+    });
+  }
+  else{
+    check(tpl_itr->open_proposals == 0, "Template is used by open proposals.");
+    _proptemplates.modify( tpl_itr, same_payer, [&]( auto& n) {
+      n.title = title;
+      n.description = description;
+      n.actions = actions;
+      n.required_threshold = max_required_threshold.threshold_name;
+    });
+  }
 }
+
 //////////////
 ACTION group::approve(name approver, uint64_t id) {
   require_auth(approver);
@@ -91,18 +130,46 @@ ACTION group::approve(name approver, uint64_t id) {
   auto prop_itr = _proposals.find(id);
   check(prop_itr != _proposals.end(), "Proposal not found.");
 
-  std::set<name> new_approvals{};
-  new_approvals.insert(approver);
-  for (name old_approver: prop_itr->approvals) {
-    //check for dups and clean out non/old custodians.
-    //todo calculate current weight here
-    if(is_custodian(old_approver, false, false)){
-      check(new_approvals.insert(old_approver).second, "You already approved this proposal.");
-    }
+  add_approvals(_proposals, prop_itr, {approver});
+}
+
+//approvals collected off-chain, each signature is over get_approval_digest() with the custodian's approval key
+ACTION group::approvesigned(uint64_t id, vector<signed_approval> approvals) {
+  check(approvals.size() > 0, "No approvals.");
+  proposals_table _proposals(get_self(), get_self().value);
+  auto prop_itr = _proposals.find(id);
+  check(prop_itr != _proposals.end(), "Proposal not found.");
+
+  checksum256 digest = get_approval_digest(prop_itr);
+  custodians_table& _custodians = custodians_db();
+  vector<name> approvers;
+  for(signed_approval sa : approvals){
+    auto cust_itr = _custodians.find(sa.approver.value);
+    check(cust_itr != _custodians.end(), "Approver is not a custodian.");
+    check(cust_itr->approval_key.has_value(), "Approver has no approval key.");
+    assert_recover_key(digest, sa.sig, cust_itr->approval_key.value() );
+    check(is_custodian(sa.approver, true, true), "Approver is not a custodian.");
+    approvers.push_back(sa.approver);
   }
-  _proposals.modify( prop_itr, same_payer, [&]( auto& n) {
-      n.last_actor = approver;
-      n.approvals = vector<name>(new_approvals.begin(), new_approvals.end() );
+  add_approvals(_proposals, prop_itr, approvers);
+}
+
+ACTION group::setchainid(checksum256 chain_id){
+  require_auth(get_self());
+  get_module_registry();//stores the modules extension when missing, extensions are written in order
+  coreconf_table& _coreconf = coreconf_db();
+  auto setting = _coreconf.get_or_default(coreconf());
+  setting.chain_id = chain_id;
+  _coreconf.set(setting, get_self());
+}
+
+ACTION group::setapprkey(name account, public_key key){
+  require_auth(account);
+  custodians_table& _custodians = custodians_db();
+  auto cust_itr = _custodians.find(account.value);
+  check(cust_itr != _custodians.end(), "You are not a custodian.");
+  _custodians.modify( cust_itr, same_payer, [&]( auto& n) {
+      n.approval_key = key;
   });
 }
 
@@ -113,6 +180,7 @@ ACTION group::unapprove(name unapprover, uint64_t id) {
   proposals_table _proposals(get_self(), get_self().value);
   auto prop_itr = _proposals.find(id);
   check(prop_itr != _proposals.end(), "Proposal not found.");
+  check(!is_exec_started(prop_itr), "Proposal is being executed.");
 
   std::set<name> new_approvals{};
   bool has_approved = false;
@@ -129,17 +197,21 @@ ACTION group::unapprove(name unapprover, uint64_t id) {
   _proposals.modify( prop_itr, same_payer, [&]( auto& n) {
       n.approvals = vector<name>(new_approvals.begin(), new_approvals.end() );
       n.last_actor = unapprover;
+      n.fill_extensions();
+      n.approval_epoch = n.approval_epoch.value() + 1;
   });
+  update_ready_state(prop_itr);
 }
 
 
 
+//the proposer or the group can cancel, also a started chunked execution. the archive row keeps exec_cursor
 ACTION group::cancel(name canceler, uint64_t id) {
   require_auth(canceler);
   proposals_table _proposals(get_self(), get_self().value);
   auto prop_itr = _proposals.find(id);
   check(prop_itr != _proposals.end(), "Proposal not found.");
-  check(prop_itr->proposer == canceler, "This is not your proposal.");
+  check(prop_itr->proposer == canceler || canceler == get_self(), "This is not your proposal.");
   _proposals.modify( prop_itr, same_payer, [&]( auto& n) {
       n.last_actor = canceler;
   });
@@ -152,6 +224,7 @@ ACTION group::exec(name executer, uint64_t id) {
   proposals_table _proposals(get_self(), get_self().value);
   auto prop_itr = _proposals.find(id);
   check(prop_itr != _proposals.end(), "Proposal not found.");
+  check(!is_exec_started(prop_itr), "Execution already started, use execnext.");
   time_point_sec now = time_point_sec(current_time_point());
 
   check( now < prop_itr->expiration, "Proposal Expired.");
@@ -163,23 +236,95 @@ ACTION group::exec(name executer, uint64_t id) {
   
   check(total_approved_weight >= highest_action_threshold, "Not enough vote weight for execution.");
 
-  //exec
-  for(action act : prop_itr->actions) { 
-      act.send();
-  }
-
-  _proposals.modify( prop_itr, same_payer, [&]( auto& n) {
-      n.last_actor = executer;
-  });
-
-  archive_proposal(name("executed"), _proposals, prop_itr);
+  execute_proposal(executer, _proposals, prop_itr, EXEC_CHUNK_SIZE);
   //_proposals.erase(prop_itr);
 
   is_custodian(executer, true, true);//this will update the timestamp if canceler is (still) custodian
 }
 
+//continues a chunked execution started by exec, no new threshold check. runs until EXEC_GRACE_SEC past the expiration
+ACTION group::execnext(name executer, uint64_t id, uint32_t max) {
+  require_auth(executer);
+  check(max > 0 && max <= EXEC_CHUNK_SIZE, "Invalid chunk size.");
+  proposals_table _proposals(get_self(), get_self().value);
+  auto prop_itr = _proposals.find(id);
+  check(prop_itr != _proposals.end(), "Proposal not found.");
+  check(is_exec_started(prop_itr), "Execution not started, use exec.");
+  check(!is_exec_abandoned(*prop_itr), "Execution window closed, the proposal can only be cancelled or archived.");
+
+  execute_proposal(executer, _proposals, prop_itr, max);
+
+  is_custodian(executer, true, true);//this will update the timestamp if executer is (still) custodian
+}
+
+//permissionless keeper action: executes (the next chunk of) ready proposals and archives expired ones,
+//including started executions past EXEC_GRACE_SEC. keepers that hit a failing proposal retry with a small max_proposals,
+//the rotating start reaches the other ones and the failing one is archived once it expires
+ACTION group::crank(uint32_t max_proposals) {
+  check(max_proposals > 0 && max_proposals <= CRANK_MAX_PROPOSALS, "Invalid number of proposals.");
+  time_point_sec now = time_point_sec(current_time_point());
+  //finish a pending ready state rescan first, it may add or drop readyprops rows
+  refresh_ready_proposals(false, max_proposals);
+  proposals_table _proposals(get_self(), get_self().value);
+
+  //collect first, archiving erases from the tables being walked.
+  //the start moves every second: a proposal whose actions fail aborts the whole crank transaction (a stored cursor
+  //would roll back with it), so a fixed start would let it block every other ready proposal until it expires
+  vector<uint64_t> all_ready_ids;
+  readyprops_table _readyprops(get_self(), get_self().value);
+  for(auto itr = _readyprops.begin(); itr != _readyprops.end(); itr++){
+    all_ready_ids.push_back(itr->id);
+  }
+  vector<uint64_t> ready_ids;
+  uint32_t start = all_ready_ids.size() > 0 ? now.sec_since_epoch() % all_ready_ids.size() : 0;
+  for(uint32_t i = 0; i < all_ready_ids.size() && ready_ids.size() < max_proposals; i++){
+    ready_ids.push_back(all_ready_ids[(start + i) % all_ready_ids.size()]);
+  }
+  vector<uint64_t> expired_ids;
+  auto by_expiration = _proposals.get_index<"byexpiration"_n>();
+  for(auto itr = by_expiration.begin(); itr != by_expiration.end() && itr->expiration <= now && ready_ids.size() + expired_ids.size() < max_proposals; itr++){
+    bool archivable = !is_exec_started_row(*itr) || is_exec_abandoned(*itr);
+    if(archivable && std::find(ready_ids.begin(), ready_ids.end(), itr->id) == ready_ids.end() ){
+      expired_ids.push_back(itr->id);
+    }
+  }
+
+  uint32_t executed = 0;
+  uint32_t expired = 0;
+  for(uint64_t id : ready_ids){
+    auto prop_itr = _proposals.find(id);
+    if(prop_itr == _proposals.end() ){
+      continue;
+    }
+    if(is_exec_abandoned(*prop_itr) ){
+      archive_proposal(name("expired"), _proposals, prop_itr);
+      expired++;
+    }
+    else if(is_exec_started(prop_itr) ){
+      execute_proposal(get_self(), _proposals, prop_itr, EXEC_CHUNK_SIZE);
+      executed++;
+    }
+    else if(now >= prop_itr->expiration){
+      archive_proposal(name("expired"), _proposals, prop_itr);
+      expired++;
+    }
+    else if(update_ready_state(prop_itr) ){
+      execute_proposal(get_self(), _proposals, prop_itr, EXEC_CHUNK_SIZE);
+      executed++;
+    }
+  }
+  for(uint64_t id : expired_ids){
+    auto prop_itr = _proposals.find(id);
+    if(prop_itr != _proposals.end() ){
+      archive_proposal(name("expired"), _proposals, prop_itr);
+      expired++;
+    }
+  }
+  print("executed:", executed, " expired:", expired);
+}
+
 ACTION group::invitecust(name account){
-  require_auth(get_self() );
+  require_auth(get_self());
   check(account != get_self(), "Self can't be a custodian.");
   
   auto conf = get_group_conf();
@@ -187,7 +332,7 @@ ACTION group::invitecust(name account){
 
   check(is_account_voice_wrapper(account), "Account does not exist or doesn't meet requirements.");
 
-  custodians_table _custodians(get_self(), get_self().value);
+  custodians_table& _custodians = custodians_db();
   auto cust_itr = _custodians.find(account.value);
 
   check(cust_itr == _custodians.end(), "Account already a custodian.");
@@ -201,7 +346,7 @@ ACTION group::invitecust(name account){
 ACTION group::removecust(name account){
   require_auth(get_self());
 
-  custodians_table _custodians(get_self(), get_self().value);
+  custodians_table& _custodians = custodians_db();
   auto cust_itr = _custodians.find(account.value);
 
   check(cust_itr != _custodians.end(), "Account is not a custodian.");
@@ -219,7 +364,7 @@ ACTION group::removecust(name account){
 
 ACTION group::imalive(name account){
   require_auth(account);
-  custodians_table _custodians(get_self(), get_self().value);
+  custodians_table& _custodians = custodians_db();
   auto cust_itr = _custodians.find(account.value);
   check(cust_itr != _custodians.end(), "You are not a custodian, no proof of live needed.");
   if(!is_account_alive(cust_itr->last_active) ){
@@ -234,12 +379,10 @@ ACTION group::imalive(name account){
 ACTION group::isetcusts(vector<name> accounts){
   
   //require_auth(get_self() );
-  childaccounts_table _childaccounts(get_self(), get_self().value);
-  auto by_module_name = _childaccounts.get_index<"bymodulename"_n>();
-  auto itr = by_module_name.find(name("elections").value);
-  check(itr != by_module_name.end(), "Group doesn't have module_name elections");
+  name elections_contract = get_module_account(name("elections") );
+  check(elections_contract != name(0), "Group doesn't have module_name elections");
 
-  require_auth(itr->account_name); //elections_contract
+  require_auth(elections_contract);
 
   int count_new = accounts.size();
   auto conf = get_group_conf();
@@ -247,7 +390,7 @@ ACTION group::isetcusts(vector<name> accounts){
   check(count_new != 0, "Empty custodian list not allowed");
 
   vector<custodians> new_custs;
-  custodians_table _custodians(get_self(), get_self().value);
+  custodians_table& _custodians = custodians_db();
   
   time_point_sec now = time_point_sec(current_time_point().sec_since_epoch());
 
@@ -282,7 +425,7 @@ ACTION group::isetcusts(vector<name> accounts){
 
   update_active();
 
-  corestate_table _corestate(get_self(), get_self().value);
+  corestate_table& _corestate = corestate_db();
   auto state = _corestate.get_or_create(get_self(), corestate());
   state.state.cust_count = count_new;
   _corestate.set(state, get_self());
@@ -295,14 +438,103 @@ ACTION group::widthdraw(name account, extended_asset amount) {
   check(account != get_self(), "Can't withdraw to self.");
   check(amount.quantity.amount > 0, "Amount must be greater then zero.");
 
-  //sub_balance(account, amount); this is handled by the on_notify !!!
-  
-  action(
-    permission_level{get_self(), "owner"_n},
-    amount.contract, "transfer"_n,
-    make_tuple(get_self(), account, amount.quantity, string("withdraw from user account"))
-  ).send();
-  
+  sub_balance(account, amount);
+  send_withdrawal(account, amount);
+}
+
+//withdraw every balance of account in one go, an empty filter withdraws all tokens
+ACTION group::withdrawall(name account, vector<extended_symbol> filter) {
+  require_auth(account);
+  check(get_group_conf().withdrawals, "Withdrawals are disabled");
+  check(account != get_self(), "Can't withdraw to self.");
+
+  //collect first, sub_balance erases the rows being walked
+  vector<extended_asset> values;
+  balances_table _balances( get_self(), account.value);
+  for(auto itr = _balances.begin(); itr != _balances.end(); itr++){
+    extended_asset value = itr->balance;
+    if(value.quantity.amount > 0 && (filter.size() == 0 || std::find(filter.begin(), filter.end(), value.get_extended_symbol() ) != filter.end() ) ){
+      values.push_back(value);
+    }
+  }
+  check(values.size() > 0, "Nothing to withdraw.");
+  for(extended_asset value : values){
+    sub_balance(account, value);
+    send_withdrawal(account, value);
+  }
+}
+
+//read-only, asserts when member liabilities + group funds exceed the tokens held by the group account
+ACTION group::solvency(extended_symbol token){
+  check(get_cursor(name("syncliabs") ) == CURSOR_DONE, "Liability totals are incomplete, run syncliabs first.");
+
+  int64_t liabilities = 0;
+  liabilities_table _liabilities( get_self(), get_self().value);
+  auto by_token = _liabilities.get_index<"bytoken"_n>();
+  auto liab_itr = by_token.find( (uint128_t{token.get_contract().value} << 64) | token.get_symbol().raw() );
+  if(liab_itr != by_token.end() ){
+    liabilities = liab_itr->total.quantity.amount;
+  }
+
+  int64_t group_funds = 0;
+  balances_table _balances( get_self(), get_self().value);
+  auto bal_itr = _balances.find( token.get_symbol().raw() );
+  if(bal_itr != _balances.end() ){
+    check(bal_itr->balance.contract == token.get_contract(), "Group balance is held in another token contract.");
+    group_funds = bal_itr->balance.quantity.amount;
+  }
+
+  int64_t holdings = 0;
+  token_accounts_table _accounts( token.get_contract(), get_self().value);
+  auto acc_itr = _accounts.find( token.get_symbol().code().raw() );
+  if(acc_itr != _accounts.end() ){
+    check(acc_itr->balance.symbol == token.get_symbol(), "Symbol precision mismatch.");
+    holdings = acc_itr->balance.amount;
+  }
+
+  print("liabilities:", liabilities, " group:", group_funds, " holdings:", holdings);
+  check(holdings >= liabilities + group_funds, "Group is insolvent for this token.");
+}
+
+//(re)counts the liability totals from the member balances, batch_size members per call.
+//a call without a running job clears the totals and starts over. deposits and withdrawals keep working meanwhile:
+//members below the cursor update the totals, the others are counted when the job reaches them.
+ACTION group::syncliabs(uint32_t batch_size){
+  require_auth(get_self());
+  check(batch_size > 0, "Batch size must be greater then zero.");
+  name job = name("syncliabs");
+  uint64_t next_key = get_cursor(job);
+  if(next_key == CURSOR_DONE || next_key == 0){
+    liabilities_table _liabilities( get_self(), get_self().value);
+    auto liab_itr = _liabilities.begin();
+    while(liab_itr != _liabilities.end() ){
+      liab_itr = _liabilities.erase(liab_itr);
+    }
+    next_key = 0;
+  }
+
+  uint32_t counter = 0;
+  members_table _members(get_self(), get_self().value);
+  auto itr = _members.lower_bound(next_key);
+  for(; itr != _members.end() && counter < batch_size; itr++, counter++){
+    balances_table _balances( get_self(), itr->account.value);
+    for(auto bal_itr = _balances.begin(); bal_itr != _balances.end(); bal_itr++){
+      change_liability_total(bal_itr->balance, false);
+    }
+    next_key = itr->account.value + 1;
+  }
+  //the done marker stays, members can't have the max name value (not a creatable account)
+  set_cursor(job, itr == _members.end() ? CURSOR_DONE : next_key, false);
+  print("counted:", counter);
+}
+
+//read-only, prints sha256 of the packed digest limbs. the full digest is the statedigest row
+ACTION group::getdigest(){
+  statedigest_table _statedigest(get_self(), get_self().value);
+  auto sd = _statedigest.get_or_default(statedigest());
+  sd.acc.resize(DIGEST_LIMBS, 0);
+  auto packed = pack(sd.acc);
+  print(sha256(packed.data(), packed.size() ) );
 }
 
 ACTION group::internalxfr(name from, name to, extended_asset amount, string msg){
@@ -317,12 +549,13 @@ ACTION group::internalxfr(name from, name to, extended_asset amount, string msg)
 }
 
 ACTION group::manthreshold(name threshold_name, int8_t threshold, bool remove){
-  require_auth(get_self() );
+  require_auth(get_self());
   insert_or_update_or_delete_threshold(threshold_name, threshold, remove, false);//!!!!!!!!!!!!! false
+  refresh_ready_proposals(true, READY_SCAN_BATCH);
 }
 
 ACTION group::manthreshlin(name contract, name action_name, name threshold_name, bool remove){
-  require_auth(get_self() );
+  require_auth(get_self());
   check(contract != name(0) && action_name != name(0), "Invalid link parameters.");
   check(threshold_name != name(0), "Threshold name can't be empty.");
   check(threshold_name != name("default"), "Default threshold can't be assigned.");
@@ -366,7 +599,7 @@ ACTION group::manthreshlin(name contract, name action_name, name threshold_name,
 }
 
 ACTION group::trunchistory( name archive_type, uint32_t batch_size){
-  require_auth(get_self() );
+  require_auth(get_self());
   check(archive_type != get_self(), "Not allowed to clear this scope.");
   proposals_table h_proposals(get_self(), archive_type.value);
   check(h_proposals.begin() != h_proposals.end(), "History scope empty.");
@@ -374,10 +607,145 @@ ACTION group::trunchistory( name archive_type, uint32_t batch_size){
   uint32_t counter = 0;
   auto itr = h_proposals.begin();
   while(itr != h_proposals.end() && counter++ < batch_size) {
+    release_payloads(itr->payload_ids.value_or(vector<uint64_t>{}) );
     itr = h_proposals.erase(itr);
   }
 }
 
+//rewrite legacy member rows in the compact layout, the freed RAM is refunded to the payer of each row.
+//legacy rows are the ones that still read a zero agreement_date (never set before the compact layout).
+//resumes from the cursor, call again until the cursor row is gone.
+ACTION group::compactmems(uint32_t batch_size){
+  require_auth(get_self());
+  check(batch_size > 0, "Batch size must be greater then zero.");
+  name job = name("compactmems");
+  uint64_t next_key = get_cursor(job);
+  uint32_t counter = 0;
+
+  members_table _members(get_self(), get_self().value);
+  auto itr = _members.lower_bound(next_key);
+  uint32_t compacted = 0;
+  for(; itr != _members.end() && counter < batch_size; itr++, counter++){
+    if(itr->agreement_date.has_value() && itr->agreement_date.value() == time_point_sec(0) ){
+      _members.modify( itr, same_payer, [&]( auto& n){
+        n.agreement_date.reset();
+      });
+      compacted++;
+    }
+    next_key = itr->account.value + 1;
+  }
+  set_cursor(job, next_key, itr == _members.end() );
+  print("checked:", counter, " compacted:", compacted);
+}
+
+//scope 0 is the group scope, archived proposals are rebuilt per archive scope (executed, cancelled, expired).
+//the cursor job is the table name for the group scope and the archive scope name otherwise.
+ACTION group::rebuildidx(name table, name scope, uint32_t batch_size){
+  require_auth(get_self());
+  check(batch_size > 0, "Batch size must be greater then zero.");
+  uint64_t db_scope = scope == name(0) ? get_self().value : scope.value;
+  name job = scope == name(0) ? table : scope;
+  uint64_t next_key = get_cursor(job);
+  uint32_t counter = 0;
+
+  if(table == name("proposals") ){
+    proposals_table _proposals(get_self(), db_scope);
+    auto itr = _proposals.lower_bound(next_key);
+    for(; itr != _proposals.end() && counter < batch_size; itr++, counter++){
+      vector<uint64_t> keys;//in index declaration order
+#if PROPOSALS_BYTHRESHOLD
+      keys.push_back(itr->by_threshold() );
+#endif
+#if PROPOSALS_BYPROPOSER
+      keys.push_back(itr->by_proposer() );
+#endif
+      keys.push_back(itr->by_expiration() );
+      rebuild_idx64_row(table, db_scope, itr->id, keys, 3);
+#if PROPOSALS_BYTRXID
+      rebuild_idx256_row(table, db_scope, itr->id, keys.size(), itr->by_trx_id(), 4);
+#else
+      rebuild_idx256_row(table, db_scope, itr->id, -1, checksum256(), 4);
+#endif
+      next_key = itr->id + 1;
+    }
+    set_cursor(job, next_key, itr == _proposals.end() );
+  }
+  else if(table == name("custodians") ){
+    check(scope == name(0), "Custodians only live in the group scope.");
+    custodians_table& _custodians = custodians_db();
+    auto itr = _custodians.lower_bound(next_key);
+    for(; itr != _custodians.end() && counter < batch_size; itr++, counter++){
+      vector<uint64_t> keys;
+#if CUSTODIANS_BYLASTACTIVE
+      keys.push_back(itr->by_last_active() );
+#endif
+      rebuild_idx64_row(table, db_scope, itr->account.value, keys, 1);
+      next_key = itr->account.value + 1;
+    }
+    set_cursor(job, next_key, itr == _custodians.end() );
+  }
+  else if(table == name("childaccount") ){
+    check(scope == name(0), "Child accounts only live in the group scope.");
+    childaccounts_table _childaccounts(get_self(), get_self().value);
+    auto itr = _childaccounts.lower_bound(next_key);
+    for(; itr != _childaccounts.end() && counter < batch_size; itr++, counter++){
+      rebuild_idx64_row(table, db_scope, itr->account_name.value, {itr->by_module_name(), itr->by_parent()}, 2);
+      next_key = itr->account_name.value + 1;
+    }
+    set_cursor(job, next_key, itr == _childaccounts.end() );
+  }
+  else{
+    check(false, "Table has no rebuildable indices.");
+  }
+}
+
+//read-only, prints the scope, id and status of the proposal created in trx_id
+ACTION group::findbytrx(checksum256 trx_id){
+#if PROPOSALS_BYTRXID
+  for(name scope : {name(0), name("executed"), name("cancelled"), name("expired")} ){
+    proposals_table _proposals(get_self(), scope == name(0) ? get_self().value : scope.value);
+    auto by_trx_id = _proposals.get_index<"bytrxid"_n>();
+    auto itr = by_trx_id.find(trx_id);
+    if(itr == by_trx_id.end() ){
+      continue;
+    }
+    name status = scope;
+    if(scope == name(0) ){
+      readyprops_table _readyprops(get_self(), get_self().value);
+      status = is_exec_started_row(*itr) ? name("executing") : _readyprops.find(itr->id) != _readyprops.end() ? name("ready") : name("open");
+    }
+    print("id:", itr->id, " scope:", scope == name(0) ? get_self() : scope, " status:", status);
+    return;
+  }
+#endif
+  check(false, "No proposal found for this transaction.");
+}
+
+ACTION group::mantoken(extended_symbol token, bool remove){
+  require_auth(get_self());
+  tokens_table _tokens(get_self(), get_self().value);
+  auto by_token = _tokens.get_index<"bytoken"_n>();
+  auto token_itr = by_token.find( (uint128_t{token.get_contract().value} << 64) | token.get_symbol().raw() );
+  if(remove){
+    check(token_itr != by_token.end(), "Token not in allowlist.");
+    by_token.erase(token_itr);
+    return;
+  }
+  check(token_itr == by_token.end(), "Token already in allowlist.");
+  check(is_account(token.get_contract() ), "Token contract isn't an existing account.");
+  _tokens.emplace( get_self(), [&]( auto& n){
+    n.id = _tokens.available_primary_key();
+    n.token = token;
+  });
+}
+
+ACTION group::settokenpol(name unknown_tokens){
+  require_auth(get_self());
+  check(unknown_tokens == name("accept") || unknown_tokens == name("ignore") || unknown_tokens == name("reject"), "Policy must be accept, ignore or reject.");
+  tokenpolicy_table _tokenpolicy(get_self(), get_self().value);
+  _tokenpolicy.set(tokenpolicy{unknown_tokens}, get_self());
+}
+
 ACTION group::regmember(name actor){
   require_auth(actor);
   groupconf conf = get_group_conf();
@@ -391,6 +759,9 @@ ACTION group::regmember(name actor){
   _members.emplace( actor, [&]( auto& n){
     n.account = actor;
   });
+#if STATE_DIGEST
+  update_digest({}, {get_member_leaf(actor)});
+#endif
   update_member_count(1);
 }
 
@@ -402,128 +773,155 @@ ACTION group::unregmember(name actor){
   auto mem_itr = _members.find(actor.value);
   check(mem_itr != _members.end(), "Accountname is not a member.");
   _members.erase(mem_itr);
+#if STATE_DIGEST
+  update_digest({get_member_leaf(actor)}, {});
+#endif
   update_member_count(-1);
 }
 
+//group import of up to MEMBER_BATCH_SIZE accounts, existing members are skipped so a resent list is harmless
+ACTION group::regmembers(vector<name> accounts, name payer){
+  require_auth(get_self());
+  check(accounts.size() <= MEMBER_BATCH_SIZE, "Too many accounts, split the list.");
+  payer = payer == name(0) ? get_self() : payer;
+  if(payer != get_self() ){
+    require_auth(payer);
+  }
+  members_table _members(get_self(), get_self().value);
+  vector<checksum256> leaves;
+  int added = 0;
+  for(name account : accounts){
+    check(account != get_self(), "Contract can't be a member of itself.");
+    check(is_account_voice_wrapper(account), "Accountname not eligible for registering as member.");
+    if(_members.find(account.value) != _members.end() ){
+      continue;
+    }
+    _members.emplace( payer, [&]( auto& n){
+      n.account = account;
+    });
+#if STATE_DIGEST
+    leaves.push_back(get_member_leaf(account) );
+#endif
+    added++;
+  }
+  if(added != 0){
+#if STATE_DIGEST
+    update_digest({}, leaves);
+#endif
+    update_member_count(added);
+  }
+  print("added:", added);
+}
+
+//group removal of up to MEMBER_BATCH_SIZE accounts, non members and members with a balance are skipped
+ACTION group::unregmembers(vector<name> accounts){
+  require_auth(get_self());
+  check(accounts.size() <= MEMBER_BATCH_SIZE, "Too many accounts, split the list.");
+  members_table _members(get_self(), get_self().value);
+  vector<checksum256> leaves;
+  int removed = 0;
+  for(name account : accounts){
+    auto mem_itr = _members.find(account.value);
+    if(mem_itr == _members.end() || member_has_balance(account) ){
+      continue;
+    }
+    _members.erase(mem_itr);
+#if STATE_DIGEST
+    leaves.push_back(get_member_leaf(account) );
+#endif
+    removed++;
+  }
+  if(removed != 0){
+#if STATE_DIGEST
+    update_digest(leaves, {});
+#endif
+    update_member_count(-removed);
+  }
+  print("removed:", removed);
+}
+
 
 
 ACTION group::spawnchildac(name new_account, asset ram_amount, asset net_amount, asset cpu_amount, name parent, name module_name){
-    require_auth(get_self() );
-    check(!is_account(new_account), "The chosen accountname is already taken.");
-
-    asset total_value = ram_amount + net_amount + cpu_amount;
-    extended_asset extended_total_value = extended_asset(total_value, name("eosio.token") );
-    sub_balance( get_self(), extended_total_value);
-
-    parent = parent == name(0) ? get_self() : parent;
-
-    bool transfer_bw = false;
-
-    vector<eosiosystem::permission_level_weight> controller_accounts_active;
-    vector<eosiosystem::permission_level_weight> controller_accounts_owner;
-
-
-    permission_level parent_active{parent, "active"_n};
-    //permission_level code_permission{new_account, name("eosio.code") };
-
-
-    eosiosystem::permission_level_weight pmlw_parent_active{
-        .permission = parent_active,
-        .weight = (uint16_t) 1,
-    };
-
-   /* eosiosystem::permission_level_weight pmlw_eosiocode{
-        .permission = code_permission,
-        .weight = (uint16_t) 1,
-    };
-    controller_accounts_owner.push_back(pmlw_eosiocode);
-    */
-
-    controller_accounts_owner.push_back(pmlw_parent_active);
-    controller_accounts_active.push_back(pmlw_parent_active);
-
-    eosiosystem::authority active_authority{
-        .threshold = 1,
-        .accounts = controller_accounts_active,
-        .waits = {},
-        .keys = {}
-    };
-
-    eosiosystem::authority owner_authority{
-        .threshold = 1,
-        .accounts = controller_accounts_owner,
-        .waits = {},
-        .keys = {}
-    };
-
-    //create new account
-    action(
-        permission_level{ get_self(), "owner"_n },
-        "eosio"_n,
-        "newaccount"_n,
-        std::make_tuple(get_self(), new_account, owner_authority, active_authority )
-    ).send();
-
-    //buy resources
-    //ram_amount + net_amount + cpu_amount
-    action(
-        permission_level{ get_self(), "owner"_n },
-        "eosio"_n,
-        "delegatebw"_n,
-        std::make_tuple(get_self(), new_account, net_amount, cpu_amount, transfer_bw )
-    ).send();
-
-    action(
-        permission_level{ get_self(), "owner"_n },
-        "eosio"_n,
-        "buyram"_n,
-        std::make_tuple(get_self(), new_account, ram_amount )
-    ).send();
-    //add new account to the child account table
-    action(
-        permission_level{ get_self(), "owner"_n },
-        get_self(),
-        "addchildac"_n,
-        std::make_tuple(new_account, parent, module_name )
-    ).send();
+    require_auth(get_self());
+    spawn_child_accounts({ childac_spec{new_account, ram_amount, net_amount, cpu_amount, parent, module_name} });
+}
+
+ACTION group::spawnchilds(vector<childac_spec> specs){
+    require_auth(get_self());
+    check(specs.size() > 0, "Empty spec list not allowed.");
+    spawn_child_accounts(specs);
+}
+
+//sent by spawn_child_accounts after its system actions, runs once their transfers consumed the prepaid amount.
+//a leftover would later absorb unrelated transfers to eosio.ram/eosio.stake without a balance debit
+ACTION group::endspawn(){
+  require_auth(get_self());
+  corestate_table& _corestate = corestate_db();
+  auto state = _corestate.get_or_default(corestate());
+  check(state.prepaid_resources.has_value() && state.prepaid_resources.value().quantity.amount == 0, "Prepaid resources not consumed.");
 }
 
 ACTION group::addchildac(name account, name parent, name module_name){
-  require_auth(get_self() );
+  require_auth(get_self());
   check(is_account(account), "The account doesn't exist.");
-  //check if account already a child
+  insert_child_account(account, parent, module_name);
+}
+
+ACTION group::remchildac(name account){
+  require_auth(get_self());
   childaccounts_table _childaccounts(get_self(), get_self().value);
   auto itr = _childaccounts.find(account.value);
-  check(itr == _childaccounts.end(), "Account is already registered as child.");
-
-  //check if parent is valid
-  parent = parent == name(0) ? get_self() : parent;
-  if(parent != get_self() ){
-    itr = _childaccounts.find(parent.value);
-    check(itr != _childaccounts.end(), "Parent account is not a child.");
-  }
+  check(itr != _childaccounts.end(), "Account is not a child.");
+  auto by_parent = _childaccounts.get_index<"byparent"_n>();
+  auto child_itr = by_parent.find(account.value);
+  check(child_itr == by_parent.end(), "Account has child accounts, use remsubtree.");
+  remove_child_account(_childaccounts, itr);
+}
 
-  //check if module name already exists
-  if(module_name != name(0) ){
-    auto by_module_name = _childaccounts.get_index<"bymodulename"_n>();
-    auto itr2 = by_module_name.find(module_name.value);
-    check(itr2 == by_module_name.end(), "Duplicate module name.");
+//removes up to max accounts of the subtree below root, leaves first, and root itself once it has no children left.
+//every step walks down from root to a leaf, so no cursor has to survive between transactions.
+ACTION group::remsubtree(name root, uint32_t max){
+  require_auth(get_self());
+  check(max > 0, "Max must be greater then zero.");
+  childaccounts_table _childaccounts(get_self(), get_self().value);
+  auto by_parent = _childaccounts.get_index<"byparent"_n>();
+  check(root == get_self() || _childaccounts.find(root.value) != _childaccounts.end(), "Root is not a child account.");
+
+  uint32_t removed = 0;
+  while(removed < max){
+    name node = root;
+    auto child_itr = by_parent.find(node.value);
+    while(child_itr != by_parent.end() ){
+      node = child_itr->account_name;
+      child_itr = by_parent.find(node.value);
+    }
+    if(node == get_self() ){
+      break;//whole tree below the group removed
+    }
+    auto itr = _childaccounts.find(node.value);
+    remove_child_account(_childaccounts, itr);
+    removed++;
+    if(node == root){
+      break;
+    }
   }
-
-  _childaccounts.emplace( get_self(), [&]( auto& n){
-      n.account_name = account;
-      n.parent = parent;
-      n.module_name = module_name;
-  });
-
+  print("removed:", removed);
 }
 
-ACTION group::remchildac(name account){
-  require_auth(get_self() );
+//read-only, prints account:parent for every account below root, depth first
+ACTION group::getsubtree(name root){
   childaccounts_table _childaccounts(get_self(), get_self().value);
-  auto itr = _childaccounts.find(account.value);
-  check(itr != _childaccounts.end(), "Account is not a child.");
-  _childaccounts.erase(itr);
+  auto by_parent = _childaccounts.get_index<"byparent"_n>();
+  vector<name> stack = {root};
+  while(stack.size() > 0){
+    name node = stack.back();
+    stack.pop_back();
+    for(auto itr = by_parent.find(node.value); itr != by_parent.end() && itr->parent == node; itr++){
+      print(itr->account_name, ":", node, " ");
+      stack.push_back(itr->account_name);
+    }
+  }
 }
 
 //notify transfer handler
@@ -533,14 +931,18 @@ void group::on_transfer(name from, name to, asset quantity, string memo){
   check(to != from, "Invalid transfer");
 
   extended_asset extended_quantity = extended_asset(quantity, get_first_receiver());
-  groupconf conf = get_group_conf();
   //////////////////////
   //incomming transfers
   //////////////////////
   if (to == get_self() ) {
     //check memo if it's a transfer to top up a user wallet
-    if(memo.substr(0, 21) == "add to user account: " ){
-      check(conf.deposits, "Deposits to user accounts is disabled.");
+    bool member_deposit = memo.substr(0, 21) == "add to user account: ";
+    //unlisted tokens are dropped or rejected before anything is read or written
+    if(!is_token_allowed(extended_quantity.get_extended_symbol(), member_deposit) ){
+      return;
+    }
+    if(member_deposit){
+      check(get_group_conf().deposits, "Deposits to user accounts is disabled.");
       string potentialaccountname = memo.length() >= 22 ? memo.substr(21, 12 ) : "";
       check(is_member(name(potentialaccountname) ), "Receiver in memo is not a registered member.");
       add_balance( name(potentialaccountname), extended_quantity);
@@ -556,14 +958,21 @@ void group::on_transfer(name from, name to, asset quantity, string memo){
   //outgoing transfers
   //////////////////////
   if (from == get_self() ) {
-    //check memo if it is a user withrawal
-    if(memo.substr(0, 26) == "withdraw from user account" ){
-      print("user withdraw");
-      check(is_member(to), "To is not an regstered member.");
-      sub_balance( to, extended_quantity);
+    //resource purchases for spawned child accounts are debited upfront
+    if(consume_prepaid_resources(to, extended_quantity) ){
+      return;
+    }
+    //user withdrawals are debited before the transfer is sent
+    if(consume_pending_withdrawal(to, extended_quantity) ){
       return;
     }
     else{
+      //tokens dropped by the ignore policy never got a balances row, sending them out leaves the books untouched
+      balances_table _balances(get_self(), get_self().value);
+      auto bal_itr = _balances.find(quantity.symbol.raw() );
+      if(bal_itr == _balances.end() || bal_itr->balance.contract != extended_quantity.contract){
+        return;
+      }
       sub_balance( from, extended_quantity);
       return;    
     }